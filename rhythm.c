@@ -1,8 +1,15 @@
 // Header including all RIV APIs
+// Build with -DHEADLESS to compile out the draw path (replay verification),
+// the outcard is the same as the normal build for the same tape
+// Build with -DPROFILE to measure the frame phases, not meant for verification
 #include <riv.h>
 #include <math.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
+#ifdef PROFILE
+#include <time.h>
+#endif
 #define SEQT_IMPL
 #include "seqt.h"
 
@@ -16,15 +23,52 @@ enum {
     TOP_Y = TILE_SIZE - 4,
     N_SLIDING_TILES = (SCREEN_SIZE - TOP_Y)/TILE_SIZE,
 
-    PERFECT_DISTANCE = TILE_SIZE/10,
-    NICE_DISTANCE = TILE_SIZE/2,
-    GOOD_DISTANCE = TILE_SIZE,
+    // default hit windows in frames from the note target frame, the old pixel distances at speed 1
+    DEFAULT_PERFECT_WINDOW = TILE_SIZE/10,
+    DEFAULT_NICE_WINDOW = TILE_SIZE/2,
+    DEFAULT_GOOD_WINDOW = TILE_SIZE,
+    // arrows stay a good window past their target, longer windows would overflow the lane queues
+    MAX_HIT_WINDOW = SCREEN_SIZE,
+
+    // press latency is kept in 1/LATENCY_ONE frames, whole frames shift the arrows
+    // and the rest shifts the judgement
+    LATENCY_ONE = 256,
+    // calibration clicks once per beat and keeps the middle half of the press offsets
+    CALIBRATION_BPM = 120,
+    CALIBRATION_PRESSES = 16,
+    // drum track rows of the default soundfont clicks
+    CLICK_TRACK = 3,
+    HIGHCLICK_ROW = 8,
+    CLICK_ROW = 9,
 
     MAX_COLS = 6,
     MAX_TICKS = 2,
     MAX_NOTE_INTERVAL = 4,
     
     N_ANIMATION_FRAMES = 40,
+
+    // slowest scroll, in frames per pixel
+    MAX_TILE_FRAMES = 2,
+    // a lane holds at most one note per spawn frame, ticks stay for the frames
+    // they take to cross the screen and arrows until their window passes
+    LANE_QUEUE_SIZE = 4*SCREEN_SIZE,
+    LANE_QUEUE_MASK = LANE_QUEUE_SIZE - 1,
+
+    CHART_SIZE = 8192,
+    // a note step emits one tick, one arrow per row and the difficulty changes
+    CHART_MAX_STEP_EVENTS = 1 + SEQT_NOTES_ROWS + 2,
+
+    SNAPSHOT_VERSION = 8,
+
+    // incard bundles are walked with an explicit stack, malformed or cyclic
+    // bundles stop at these limits instead of recursing forever
+    INCARD_MAX_DEPTH = 8,
+    INCARD_MAX_ENTRIES = 4096,
+    SONG_CATALOG_SIZE = 1024,
+
+    // judged presses and misses for the final outcard, 2 bytes each unless far apart
+    EVENT_LOG_SIZE = 32*1024,
+    EVENT_LANE_SHIFT = 3,
 };
 
 enum {
@@ -41,6 +85,13 @@ enum {
     BEAT_TICK,
 };
 
+enum {
+    CHART_TICK,
+    CHART_ARROW,
+    CHART_SPEED_CHANGE,
+    CHART_INTERVAL_CHANGE,
+};
+
 enum {
     NOT_ENDED,
     MUSIC_END,
@@ -48,109 +99,485 @@ enum {
     MISSES_END,
 };
 
+enum {
+    OUTCARD_FRAME,
+    OUTCARD_SCORE,
+    OUTCARD_NOTES_INTERVAL,
+    OUTCARD_SPEED,
+    OUTCARD_MAX_COMBO,
+    OUTCARD_MAX_COMBO_SCORE,
+    OUTCARD_N_PERFECT,
+    OUTCARD_N_NICE,
+    OUTCARD_N_GOOD,
+    OUTCARD_N_MISS,
+    OUTCARD_N_BAD,
+    OUTCARD_END_REASON,
+    OUTCARD_LATENCY,
+    N_OUTCARD_FIELDS,
+
+    OUTCARD_TEXT_SIZE = 24,
+    OUTCARD_BINARY_VERSION = 3,
+    // upper bounds of the outcard parts besides the event log data, which gets the space left
+    OUTCARD_FIELDS_SIZE = 1024,
+    OUTCARD_EVENTS_HEADER_SIZE = 256,
+    OUTCARD_PROFILE_SIZE = 2048,
+};
+
+enum {
+    HUD_COMBO,
+    HUD_MISSES,
+    HUD_SPEED,
+    HUD_DIFFICULTY,
+    HUD_SCORE,
+    HUD_SONG_HASH,
+    HUD_SONG,
+    HUD_LATENCY,
+    N_HUD_TEXTS,
+
+    HUD_TEXT_SIZE = 32,
+};
+
 char *version = "v0.1";
 
-// Game state
-bool wait; // true when game has started
-int random_wait_frame;
-bool started; // true when game has started
-bool ended; // true when game has ended
-bool last_tick = false;
-int frame_increase_speed;
-int frame_increase_speed_buffer;
+// live notes of a lane, ordered by target (head is the earliest to reach the mark)
+typedef struct lane_note {
+    int frame;  // spawn frame
+    int y;      // cached screen position, only for drawing
+    int target; // frame the note reaches the mark, arrows are hit on it
+} lane_note;
+
+typedef struct lane_queue {
+    lane_note notes[LANE_QUEUE_SIZE];
+    int head;
+    int count;
+} lane_queue;
+
+// formatted outcard fields, only reformatted when their value changes
+typedef struct outcard_cache {
+    bool valid;
+    int64_t values[N_OUTCARD_FIELDS];
+    char texts[N_OUTCARD_FIELDS][OUTCARD_TEXT_SIZE];
+    uint8_t lens[N_OUTCARD_FIELDS];
+} outcard_cache;
+
+#ifdef PROFILE
+// scopes nest, update includes the game phases and spawn includes chart refills
+enum {
+    PROFILE_UPDATE,
+    PROFILE_JUDGEMENT,
+    PROFILE_ARROWS,
+    PROFILE_TICKS,
+    PROFILE_SPAWN,
+    PROFILE_CHART,
+    PROFILE_MUSIC,
+    PROFILE_OUTCARD,
+    PROFILE_DRAW,
+    N_PROFILE_SCOPES,
+
+    PROFILE_WINDOW = 60, // frames of the overlay stats
+    PROFILE_WORST_FRAMES = 8,
+};
+
+typedef struct profile_stats {
+    uint64_t min;
+    uint64_t max;
+    uint64_t sum;
+    uint64_t n;
+} profile_stats;
+
+// costliest frames of the run and the phase that took most of each
+typedef struct profile_frame {
+    uint64_t frame;
+    uint64_t cycles;
+    uint8_t phase;
+} profile_frame;
+
+// cycles spent in each scope, accumulated over the frame and then into the stats
+typedef struct profile_state {
+    uint64_t frame_cycles[N_PROFILE_SCOPES];
+    profile_stats window[N_PROFILE_SCOPES];
+    profile_stats shown[N_PROFILE_SCOPES]; // last full window
+    profile_stats total[N_PROFILE_SCOPES]; // whole run, written to the final outcard
+    int window_frames;
+    profile_frame worst[PROFILE_WORST_FRAMES]; // costliest first
+    int n_worst;
+    bool overlay;
+} profile_state;
+
+#define PROFILE_BEGIN(scope) uint64_t profile_start_##scope = profile_clock()
+#define PROFILE_END(game, scope) ((game)->profile.frame_cycles[scope] += profile_clock() - profile_start_##scope)
+#else
+#define PROFILE_BEGIN(scope)
+#define PROFILE_END(game, scope)
+#endif
+
+// formatted HUD texts, only reformatted when their value changes
+typedef struct hud_cache {
+    bool valid[N_HUD_TEXTS];
+    int64_t values[N_HUD_TEXTS];
+    char texts[N_HUD_TEXTS][HUD_TEXT_SIZE];
+} hud_cache;
+
+// judged presses and misses, appended to the final outcard
+typedef struct event_log {
+    uint8_t data[EVENT_LOG_SIZE];
+    uint32_t size;
+    uint32_t n_events;
+    uint32_t n_dropped; // events that did not fit
+    int start_frame; // game start, the first frame delta is from it
+    int last_frame;
+} event_log;
+
+// compiled chart event, spawns and difficulty changes sorted by frame
+typedef struct chart_event {
+    int frame;
+    int target; // frame the arrow should be hit
+    uint8_t type;
+    uint8_t lane; // arrow lane or tick type
+    uint8_t row;  // note row of the arrow
+} chart_event;
+
+// song of the catalog, the source is used in place and only the chosen song has a sound
+typedef struct catalog_song {
+    seqt_source *source;
+    uint32_t offset; // in the incard
+    uint32_t size;
+    uint32_t hash;
+    bool mapped; // loaded with seqt_make_source_from_file, not part of the incard
+} catalog_song;
+
+// MICS bundle being walked by the incard indexer
+typedef struct incard_bundle {
+    uint32_t offset;
+    uint32_t size;
+    uint32_t n_entries;
+    uint32_t next_entry;
+} incard_bundle;
+
+// Game state, the cartridge keeps a single instance but host tools may run many
+typedef struct game_state {
+    seqt_context seqt; // sounds of this instance
+
+    bool wait; // true when game has started
+    int random_wait_frame;
+    bool started; // true when game has started
+    bool ended; // true when game has ended
+    bool last_tick;
+    int frame_increase_speed;
+    uint8_t end_reason;
+    outcard_cache outcard;
+    hud_cache hud;
+    event_log events;
+
+    // Latency calibration, started from the start screen
+    bool calibrating;
+    seqt_source *calibration_source; // steady clicks, made on the first calibration
+    uint64_t calibration_sound;
+    seqt_clock calibration_clock; // same as the click sound clock
+    int calibration_start_frame; // riv frame of the click sound frame 0
+    int calibration_offsets[CALIBRATION_PRESSES]; // press minus nearest click, in 1/LATENCY_ONE frames
+    int n_calibration_offsets;
+#ifdef PROFILE
+    profile_state profile;
+#endif
+
+    // Chart compiler state (runs ahead of the game)
+    chart_event chart[CHART_SIZE];
+    seqt_clock chart_clock; // same tempo as the music, at the chart look ahead frame
+    int chart_len;
+    int chart_cursor;
+    bool chart_done;
+    int chart_start_frame;
+    uint64_t chart_step;
+    float chart_new_tile_speed;
+    int chart_notes_interval;
+    int frame_increase_speed_buffer;
+    int last_note_evaluated;
+    int counter_last_speed_change;
+    int counter_last_interval_change;
+    int counter_last_track_change;
+
+    int x_cols[MAX_COLS];
+    bool pressed[MAX_COLS];
+    lane_queue sliding_arrows[MAX_COLS];
+    int  pressed_match[MAX_COLS];
+    int  animation_match[MAX_COLS];
+    int  animation_frames[MAX_COLS];
+    bool sliding_speed_indicator[SCREEN_SIZE];
+    lane_queue sliding_ticks[MAX_TICKS];
+
+    float tile_speed;
+    float new_tile_speed;
+    bool perfect_hit;
+    bool nice_hit;
+    bool good_hit;
+
+    uint64_t combo_moves;
+    uint64_t consecutive_misses;
+    int score;
+
+    int base_score;
+
+    int n_perfects;
+    int n_nice;
+    int n_good;
+    int n_miss;
+    int n_bad;
+    int max_combo_score;
+    int max_combo;
+
+    float beat_guide_tick_size;
+    catalog_song songs[SONG_CATALOG_SIZE];
+    int n_songs;
+    int chosen_song;
+    uint64_t chosen_sound; // sound of the chosen song, 0 until it is activated
+    int frames_until_mark; // depends on the current speed
+
+    // lane of each note row, per notes interval and track, built when a song is activated
+    uint8_t lane_mappings[MAX_NOTE_INTERVAL][SEQT_NOTES_TRACKS][SEQT_NOTES_ROWS];
+    uint64_t n_notes_y_used;
+
+    // Parameters
+    float perfect_multiplier;
+    float nice_multiplier;
+    float good_multiplier;
+    int perfect_window; // hit windows in frames, perfect <= nice <= good
+    int nice_window;
+    int good_window;
+    int notes_interval;
+    int speed_increase_interval;
+    int notes_increase_interval;
+    float tile_speed_modifier;
+    int n_cols;
+    bool show_stats;
+    int max_misses;
+    int n_loops;
+    uint8_t focus_track;
+    uint8_t next_tracks[SEQT_NOTES_TRACKS];
+    uint8_t track_change_intervals[SEQT_NOTES_TRACKS];
+    int fix_frame;
+    int latency; // presses come this late after the music notes, in 1/LATENCY_ONE frames
+    bool binary_outcard;
+#ifdef PROFILE
+    bool stress; // adversarial song and every key mashed each frame
+#endif
+} game_state;
+
 uint64_t spritesheet_controls;
-int last_note_evaluated = -1;
-int counter_last_speed_change = 0;
-int counter_last_interval_change = 0;
-int counter_last_track_change = 0;
-uint8_t end_reason = NOT_ENDED;
 
+#ifdef PROFILE
+static const char *profile_names[N_PROFILE_SCOPES] = {
+    "update","judgement","arrows","ticks","spawn","chart","music","outcard","draw",
+};
+#endif
+
+#ifndef HEADLESS
 static int col_sprite_ids[MAX_COLS] = {3,1,4,5,0,2};
+#endif
 static int col_sprite_order[MAX_COLS] = {2,3,4,5,1,6};
-static int x_cols[MAX_COLS];
 static int key_codes[MAX_COLS] = {RIV_GAMEPAD1_LEFT,RIV_GAMEPAD1_UP,RIV_GAMEPAD1_DOWN,RIV_GAMEPAD1_RIGHT,RIV_GAMEPAD1_L1,RIV_GAMEPAD1_R1};
 static int alternative_key_codes[MAX_COLS] = {RIV_GAMEPAD1_A3,RIV_GAMEPAD1_A4,RIV_GAMEPAD1_A1,RIV_GAMEPAD1_A2,RIV_GAMEPAD1_L2,RIV_GAMEPAD1_R2};
-
-static bool pressed[MAX_COLS];
-static int  sliding_arrows[MAX_COLS][SCREEN_SIZE];
-static int  pressed_match[MAX_COLS];
-static int  animation_match[MAX_COLS];
-static int  animation_frames[MAX_COLS];
-static bool sliding_speed_indicator[SCREEN_SIZE];
-static int  sliding_ticks[MAX_TICKS][SCREEN_SIZE];
+#ifndef HEADLESS
 static int  tick_colors[MAX_TICKS] = {RIV_COLOR_GREY,RIV_COLOR_LIGHTGREY,};
+#endif
+static const char *outcard_keys[N_OUTCARD_FIELDS] = {
+    "JSON{\"frame\":",",\"score\":",",\"notes_interval\":",",\"speed\":",",\"max_combo\":",",\"max_combo_score\":",
+    ",\"n_perfect\":",",\"n_nice\":",",\"n_good\":",",\"n_miss\":",",\"n_bad\":",",\"end_reason\":",",\"latency\":",
+};
 
-float tile_speed;
-float new_tile_speed = 1;
-bool perfect_hit;
-bool nice_hit;
-bool good_hit;
-
-uint64_t combo_moves = 0;
-uint64_t consecutive_misses = 0;
-int score = 0;
-
-int base_score = 100;
-
-int n_perfects = 0;
-int n_nice = 0;
-int n_good = 0;
-int n_miss = 0;
-int n_bad = 0;
-int max_combo_score = 0;
-int max_combo = 0;
-
-float hits_per_second;
-float note_period;
-float beat_guide_tick_size;
-float frames_per_beat;
-int n_sounds = 0;
-int chosen_sound_ind = -1;
-uint64_t chosen_sound;
-uint64_t sound_ids[SEQT_MAX_SOUNDS];
-uint32_t sound_hashes[SEQT_MAX_SOUNDS];
-int frames_until_mark = 0; // depends on the current speed
-
-uint64_t notes_y_cols_mapping[SEQT_NOTES_TRACKS][SEQT_NOTES_ROWS];
-uint64_t n_notes_y_used = SEQT_NOTES_ROWS;
-
-
-float perfect_multiplier = 4.0;
-float nice_multiplier = 1.5;
-float good_multiplier = 1.0;
-int notes_interval = 3;
-int speed_increase_interval = 14;
-int notes_increase_interval = 21;
-float tile_speed_modifier = 1.5;
-int n_cols = 4;
-bool show_stats = true;
-int max_misses = 10;
-int n_loops = 8;
-uint8_t focus_track = 1;
-static uint8_t next_tracks[SEQT_NOTES_TRACKS] = {1,2,3,0};
-static uint8_t track_change_intervals[SEQT_NOTES_TRACKS] = {0,0,0,0};
-int fix_frame = 0;
+// Cartridge game instance
+static game_state game;
+
+// Reset a game instance to the default parameters
+void init_game_state(game_state *game) {
+    *game = (game_state){
+        .end_reason = NOT_ENDED,
+        .last_note_evaluated = -1,
+        .new_tile_speed = 1,
+        .base_score = 100,
+        .chosen_song = -1,
+        .n_notes_y_used = SEQT_NOTES_ROWS,
+        .perfect_multiplier = 4.0,
+        .nice_multiplier = 1.5,
+        .good_multiplier = 1.0,
+        .perfect_window = DEFAULT_PERFECT_WINDOW,
+        .nice_window = DEFAULT_NICE_WINDOW,
+        .good_window = DEFAULT_GOOD_WINDOW,
+        .notes_interval = 3,
+        .speed_increase_interval = 14,
+        .notes_increase_interval = 21,
+        .tile_speed_modifier = 1.5,
+        .n_cols = 4,
+        .show_stats = true,
+        .max_misses = 10,
+        .n_loops = 8,
+        .focus_track = 1,
+        .next_tracks = {1,2,3,0},
+        .track_change_intervals = {0,0,0,0},
+        .fix_frame = 0,
+    };
+}
 
 // utils
-uint32_t simple_hash(const char *s, size_t len) {
-    unsigned char *p = (unsigned char*) s;
-    uint32_t h = 0;
-    while(len--) {
-        h += *p++;
-        h += (h << 10);
-        h ^= (h >> 6);
-    }
-    h += (h << 3);
-    h ^= (h >> 11);
-    h += (h << 15);
-    return h;
-}
-
-uint64_t get_note_frame(uint64_t frame) {
-    seqt_sound *sound = seqt_get_sound(chosen_sound);
+// hashes 8 bytes per step, the tail is packed into a last word
+uint32_t word_hash(const uint8_t *data, size_t len) {
+    uint64_t h = 0x9e3779b97f4a7c15ULL ^ len;
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t w;
+        memcpy(&w, data + i, 8);
+        h = (h ^ w) * 0xff51afd7ed558ccdULL;
+        h ^= h >> 32;
+    }
+    if (i < len) {
+        uint64_t w = 0;
+        memcpy(&w, data + i, len - i);
+        h = (h ^ w) * 0xff51afd7ed558ccdULL;
+        h ^= h >> 32;
+    }
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 29;
+    return (uint32_t)(h ^ (h >> 32));
+}
+
+uint32_t read_be32(const uint8_t *p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+#ifdef PROFILE
+// cycle counter on RISC-V, nanoseconds on a host build
+uint64_t profile_clock(void) {
+#if defined(__riscv)
+    uint64_t cycles;
+    asm volatile("rdcycle %0" : "=r"(cycles));
+    return cycles;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000000ULL + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+void profile_add(profile_stats *stats, uint64_t cycles) {
+    if (stats->n == 0 || cycles < stats->min) stats->min = cycles;
+    if (cycles > stats->max) stats->max = cycles;
+    stats->sum += cycles;
+    stats->n++;
+}
+
+// keep the frame if it is among the costliest, with its dominant phase
+void profile_rank_frame(profile_state *profile) {
+    uint64_t *cycles = profile->frame_cycles;
+    uint64_t total = cycles[PROFILE_UPDATE] + cycles[PROFILE_DRAW];
+    if (profile->n_worst == PROFILE_WORST_FRAMES && total <= profile->worst[PROFILE_WORST_FRAMES-1].cycles) return;
+
+    // phases without the scopes nested in them, update keeps what no other scope covers
+    uint64_t phases[N_PROFILE_SCOPES];
+    memcpy(phases, cycles, sizeof(phases));
+    phases[PROFILE_SPAWN] -= minu(phases[PROFILE_SPAWN], phases[PROFILE_CHART]);
+    uint64_t nested = 0;
+    for (int s = PROFILE_UPDATE + 1; s < PROFILE_DRAW; s++) nested += phases[s];
+    phases[PROFILE_UPDATE] -= minu(phases[PROFILE_UPDATE], nested);
+    uint8_t phase = PROFILE_DRAW;
+    for (int s = 0; s < N_PROFILE_SCOPES; s++) {
+        if (phases[s] > phases[phase]) phase = s;
+    }
+
+    int i = profile->n_worst < PROFILE_WORST_FRAMES ? profile->n_worst++ : PROFILE_WORST_FRAMES-1;
+    while (i > 0 && profile->worst[i-1].cycles < total) {
+        profile->worst[i] = profile->worst[i-1];
+        i--;
+    }
+    profile->worst[i] = (profile_frame){.frame = riv->frame, .cycles = total, .phase = phase};
+}
+
+// move this frame cycles into the stats, scopes that didn't run are left out
+void profile_end_frame(game_state *game) {
+    profile_state *profile = &game->profile;
+    profile_rank_frame(profile);
+    for (int s = 0; s < N_PROFILE_SCOPES; s++) {
+        uint64_t cycles = profile->frame_cycles[s];
+        if (cycles == 0) continue;
+        profile_add(&profile->window[s], cycles);
+        profile_add(&profile->total[s], cycles);
+        profile->frame_cycles[s] = 0;
+    }
+    if (++profile->window_frames == PROFILE_WINDOW) {
+        memcpy(profile->shown, profile->window, sizeof(profile->shown));
+        memset(profile->window, 0, sizeof(profile->window));
+        profile->window_frames = 0;
+    }
+}
+
+#endif
+
+// scroll speed kept fast enough for the notes on screen to fit the lane queues
+float bound_speed(float speed) {
+    return fmaxf(speed, 1.0f / MAX_TILE_FRAMES);
+}
+
+// lane queues
+lane_note *lane_at(lane_queue *q, int k) {
+    return &q->notes[(q->head + k) & LANE_QUEUE_MASK];
+}
+
+void lane_clear(lane_queue *q) {
+    q->head = 0;
+    q->count = 0;
+}
+
+void lane_pop(lane_queue *q) {
+    q->head = (q->head + 1) & LANE_QUEUE_MASK;
+    q->count--;
+}
+
+// place a note among the first n notes keeping them ordered, after the notes with
+// the same target. Only a note spawned on the same frame for the same target replaces
+// another one, as rows of a note step mapped to the same lane are one arrow.
+// A full lane drops the note.
+void lane_place(lane_queue *q, int *n, lane_note note) {
+    int j = *n;
+    while (j > 0 && lane_at(q,j-1)->target > note.target) j--;
+    for (int k = j; k > 0 && lane_at(q,k-1)->target == note.target; k--) {
+        if (lane_at(q,k-1)->frame == note.frame) {
+            *lane_at(q,k-1) = note;
+            return;
+        }
+    }
+    if (*n == LANE_QUEUE_SIZE) return;
+    for (int k = *n; k > j; k--) *lane_at(q,k) = *lane_at(q,k-1);
+    *lane_at(q,j) = note;
+    (*n)++;
+}
+
+void lane_push(lane_queue *q, int frame, int y, int target) {
+    lane_place(q, &q->count, (lane_note){.frame = frame, .y = y, .target = target});
+}
+
+// move the lane notes to this frame positions, returns how many went above min_y
+int lane_advance(game_state *game, lane_queue *q, int min_y) {
+    int n = 0;
+    int n_left = 0;
+    for (int k = 0; k < q->count; k++) {
+        lane_note note = *lane_at(q,k);
+        float s = note.frame > game->frame_increase_speed ? game->new_tile_speed : game->tile_speed;
+        note.y = (int)round(SCREEN_SIZE - 1 - (riv->frame - note.frame) * s);
+        if (note.y < min_y) {
+            n_left++;
+            continue;
+        }
+        // moving doesn't change the targets, the order holds
+        *lane_at(q,n++) = note;
+    }
+    q->count = n;
+    return n_left;
+}
+
+uint64_t get_note_frame(game_state *game, uint64_t frame) {
+    seqt_sound *sound = seqt_get_sound(&game->seqt, game->chosen_sound);
     if (frame < sound->start_frame) return 0;
 
-    uint64_t note_frame = (uint64_t)floor(((double)(frame - sound->start_frame) * hits_per_second * sound->speed) / riv->target_fps);
+    uint64_t note_frame = seqt_clock_seek(&game->chart_clock, frame - sound->start_frame);
 
     if (sound->loops >= 0 && (note_frame / seqt_get_source_track_size(sound->source)) >= (uint64_t)sound->loops)
         return seqt_get_source_track_size(sound->source) * (uint64_t)sound->loops - 1;
@@ -158,96 +585,482 @@ uint64_t get_note_frame(uint64_t frame) {
     return note_frame;
 }
 
-uint64_t get_note_x(uint64_t track,uint64_t note_frame) {
-    seqt_sound *sound = seqt_get_sound(chosen_sound);
+// latency rounded to whole frames, applied when the arrows are spawned
+int latency_frames(game_state *game) {
+    int half = game->latency >= 0 ? LATENCY_ONE/2 : -LATENCY_ONE/2;
+    return (game->latency + half) / LATENCY_ONE;
+}
+
+uint64_t get_note_x(game_state *game, uint64_t track,uint64_t note_frame) {
+    seqt_sound *sound = seqt_get_sound(&game->seqt, game->chosen_sound);
 
     return note_frame % maxu(sound->source->track_sizes[track], SEQT_NOTES_COLUMNS);
 }
 
-void read_incard_data(uint8_t *data,int from,int size) {
-    char magic[5];
-    for (int i=0; i<MAGIC_SIZE ; i++) magic[i] = data[from + i];
-    magic[MAGIC_SIZE] = '\0';
+// add a SEQT entry to the catalog or push a MICS bundle, entries are within the incard
+bool index_incard_entry(game_state *game, incard_bundle *stack, int *depth,
+                        const uint8_t *data, uint32_t offset, uint32_t size) {
+    if (size < MAGIC_SIZE) return true;
+    const uint8_t *entry = data + offset;
+
+    if (memcmp(entry, "SEQT", MAGIC_SIZE) == 0) {
+        if (size < sizeof(seqt_source)) return true;
+        if (game->n_songs == SONG_CATALOG_SIZE) return false;
+        game->songs[game->n_songs++] = (catalog_song){
+            .source = (seqt_source*)entry,
+            .offset = offset,
+            .size = size,
+            .hash = word_hash(entry, sizeof(seqt_source)),
+        };
+    } else if (memcmp(entry, "MICS", MAGIC_SIZE) == 0) {
+        // header is the magic and the entry count, then (offset,size) pairs
+        // relative to the bundle start
+        if (size < 2*MAGIC_SIZE || *depth == INCARD_MAX_DEPTH) return true;
+        uint32_t n_entries = read_be32(entry + MAGIC_SIZE);
+        if (n_entries > (size - 2*MAGIC_SIZE) / (2*MAGIC_SIZE)) return true;
+        stack[(*depth)++] = (incard_bundle){
+            .offset = offset,
+            .size = size,
+            .n_entries = n_entries,
+        };
+    }
+    return true;
+}
+
+// walk the incard once depth first, songs keep their order in the bundle
+void read_incard_data(game_state *game, const uint8_t *data, uint32_t len) {
+    incard_bundle stack[INCARD_MAX_DEPTH];
+    int depth = 0;
+    int n_entries = 0;
+
+    bool more = index_incard_entry(game, stack, &depth, data, 0, len);
+    while (more && depth > 0) {
+        incard_bundle *bundle = &stack[depth - 1];
+        if (bundle->next_entry == bundle->n_entries || n_entries == INCARD_MAX_ENTRIES) {
+            depth--;
+            continue;
+        }
+        const uint8_t *pair = data + bundle->offset + 2*MAGIC_SIZE*(1 + bundle->next_entry);
+        bundle->next_entry++;
+        n_entries++;
+
+        uint32_t offset = read_be32(pair);
+        uint32_t size = read_be32(pair + MAGIC_SIZE);
+        if (offset > bundle->size || size > bundle->size - offset) continue;
+        more = index_incard_entry(game, stack, &depth, data, bundle->offset + offset, size);
+    }
+}
+
+// map the rows used by each track to lanes, for every notes interval
+void build_lane_mappings(game_state *game) {
+    seqt_sound *sound = seqt_get_sound(&game->seqt, game->chosen_sound);
+    memset(game->lane_mappings, 0, sizeof(game->lane_mappings));
+    for (int interval = 1; interval <= MAX_NOTE_INTERVAL; interval++) {
+        for (int t = 0; t < SEQT_NOTES_TRACKS; t++) {
+            // only the columns with notes are visited
+            uint16_t rows_with_notes = 0;
+            for (uint64_t x = seqt_next_note_column(&sound->index, t, 0); x < SEQT_NOTES_TOTAL_COLUMNS; x = seqt_next_note_column(&sound->index, t, x + 1)) {
+                if (x % interval == 0) rows_with_notes |= sound->index.row_masks[t][x];
+            }
+            uint8_t arrow_cols = 0;
+            for (int y = 0; y < SEQT_NOTES_ROWS; y++) {
+                if (rows_with_notes & (1 << y)) {
+                    game->lane_mappings[interval-1][t][y] = arrow_cols%game->n_cols;
+                    arrow_cols++;
+                }
+            }
+        }
+    }
+}
 
-    if (!strcmp(magic,"SEQT")) {
-        sound_ids[n_sounds] = seqt_play((seqt_source*)(data + from),n_loops);
-        n_sounds++;
-    } else if (!strcmp(magic,"MICS")) {
-        int wi = from + MAGIC_SIZE; // curr_word_index
+// replace the sound of the chosen song, the other songs stay as references
+void activate_song(game_state *game, int i) {
+    seqt_stop(&game->seqt, game->chosen_sound);
+    game->chosen_song = i;
+    game->chosen_sound = seqt_play(&game->seqt, game->songs[i].source, game->n_loops);
+    build_lane_mappings(game);
+}
 
-        uint32_t n_incards = data[from + wi+3] | (uint32_t)data[from + wi+2] << 8
-            | (uint32_t)data[from + wi+1] << 16 | (uint32_t)data[from + wi] << 24;
-        wi += MAGIC_SIZE;
+// expand the song note steps into chart events, until the chart is full or the song ends
+void compile_chart(game_state *game) {
+    seqt_sound *sound = seqt_get_sound(&game->seqt, game->chosen_sound);
+    int last_note = (int)(seqt_get_source_track_size(sound->source) * (uint64_t)sound->loops) - 1;
+    uint8_t (*lane_mapping)[SEQT_NOTES_ROWS] = game->lane_mappings[game->chart_notes_interval-1];
+    game->chart_len = 0;
+    game->chart_cursor = 0;
+    while (!game->chart_done && game->chart_len + CHART_MAX_STEP_EVENTS <= CHART_SIZE) {
+        int frame = game->chart_start_frame + (int)game->chart_step;
+        // a latency larger than the frames until the mark would look before the music start
+        int64_t music_frame = (int64_t)game->chart_step + game->frames_until_mark + game->fix_frame - latency_frames(game);
+        int note_to_evaluate = get_note_frame(game, music_frame > 0 ? (uint64_t)music_frame : 0);
+        game->chart_step++;
+
+        if (note_to_evaluate > game->last_note_evaluated) {
+            // add beat/hit tick
+            game->chart[game->chart_len++] = (chart_event){
+                .frame = frame,
+                .target = frame + game->frames_until_mark,
+                .type = CHART_TICK,
+                .lane = note_to_evaluate % SEQT_TIME_SIG != 0 ? HIT_TICK : BEAT_TICK,
+            };
+
+            // add arrow
+            if (note_to_evaluate % game->chart_notes_interval == 0) {
+                uint64_t note_x = get_note_x(game, game->focus_track,note_to_evaluate);
+                uint16_t rows = note_x < SEQT_NOTES_TOTAL_COLUMNS ? sound->index.row_masks[game->focus_track][note_x] : 0;
+                for (uint64_t note_y = 0; note_y < SEQT_NOTES_ROWS; ++note_y) {
+                    if (rows & (1 << note_y)) {
+                        game->chart[game->chart_len++] = (chart_event){
+                            .frame = frame,
+                            .target = frame + game->frames_until_mark,
+                            .type = CHART_ARROW,
+                            .lane = lane_mapping[game->focus_track][note_y],
+                            .row = note_y,
+                        };
+                    }
+                }
+            }
 
-        for (int i=0; i<n_incards ; i++) {
+            // update speed difficulty
+            game->counter_last_speed_change++;
+            if (game->speed_increase_interval > 0 && 
+                    game->counter_last_speed_change/SEQT_NOTES_COLUMNS >= game->speed_increase_interval &&
+                    frame > game->frame_increase_speed_buffer) {
+                game->chart[game->chart_len++] = (chart_event){.frame = frame, .type = CHART_SPEED_CHANGE};
+                game->chart_new_tile_speed = bound_speed(game->tile_speed_modifier * game->chart_new_tile_speed);
+                game->frame_increase_speed_buffer = frame + game->frames_until_mark;
+                game->frames_until_mark = (int)round(N_SLIDING_TILES*TILE_SIZE/game->chart_new_tile_speed);
+                game->counter_last_speed_change = 0;
+            }
 
-            uint32_t from_incard_i = data[from + wi+3] | (uint32_t)data[from + wi+2] << 8
-                | (uint32_t)data[from + wi+1] << 16 | (uint32_t)data[from + wi] << 24;
-            wi += MAGIC_SIZE;
+            // update notes interval difficulty
+            game->counter_last_interval_change++;
+            if (game->notes_increase_interval > 0 && game->counter_last_interval_change/SEQT_NOTES_COLUMNS >= game->notes_increase_interval) {
+                if (game->chart_notes_interval > 1) {
+                    game->chart[game->chart_len++] = (chart_event){.frame = frame, .type = CHART_INTERVAL_CHANGE};
+                    game->chart_notes_interval = game->chart_notes_interval -1;
+                    lane_mapping = game->lane_mappings[game->chart_notes_interval-1];
+                }
+                game->counter_last_interval_change = 0;
+            }
 
-            uint32_t size_incard_i =data[from + wi+3] | (uint32_t)data[from + wi+2] << 8
-                | (uint32_t)data[from + wi+1] << 16 | (uint32_t)data[from + wi] << 24;
-            wi += MAGIC_SIZE;
+            // change track
+            game->counter_last_track_change++;
+            if (game->track_change_intervals[game->focus_track] > 0 && game->counter_last_track_change/SEQT_NOTES_COLUMNS >= game->track_change_intervals[game->focus_track]) {
+                game->focus_track = game->next_tracks[game->focus_track];
+                game->counter_last_track_change = 0;
+            }
 
-            read_incard_data(data,from_incard_i,size_incard_i);
+            game->last_note_evaluated = note_to_evaluate;
         }
 
+        // note frames stay at the last note once the loops are over
+        if (sound->loops >= 0 && note_to_evaluate >= last_note) game->chart_done = true;
     }
 }
 
-void update_notes_mapping() {
-    // create mapping for used notes in focus track
-    seqt_sound *sound = seqt_get_sound(chosen_sound);
-    for (int t = 0; t < SEQT_NOTES_TRACKS; t++) {
-        bool row_has_note[SEQT_NOTES_ROWS];
-        for (int y = 0; y < SEQT_NOTES_ROWS; y++) {
-            row_has_note[y] = false;
+// outcard
+int format_int(char *buf, int64_t value) {
+    char digits[20];
+    int n = 0;
+    int len = 0;
+    uint64_t u = value < 0 ? -(uint64_t)value : (uint64_t)value;
+    do {
+        digits[n++] = '0' + u % 10;
+        u /= 10;
+    } while (u);
+    if (value < 0) buf[len++] = '-';
+    while (n) buf[len++] = digits[--n];
+    return len;
+}
+
+void put_le(uint8_t *data, uint64_t value, int n_bytes) {
+    for (int i = 0; i < n_bytes; i++) data[i] = (uint8_t)(value >> (8*i));
+}
+
+// Event log entry: frame delta from the previous event (or the game start) as a
+// little endian base 128 varint, then lane << 3 | grade (STATE_MISS to STATE_PERFECT)
+void log_event(event_log *log, int frame, int lane, int grade) {
+    uint8_t entry[6];
+    int n = 0;
+    uint32_t delta = frame - log->last_frame;
+    do {
+        entry[n] = delta & 0x7f;
+        delta >>= 7;
+        if (delta) entry[n] |= 0x80;
+        n++;
+    } while (delta);
+    entry[n++] = (uint8_t)(lane << EVENT_LANE_SHIFT | grade);
+    if (log->size + n > EVENT_LOG_SIZE) {
+        log->n_dropped++;
+        return;
+    }
+    memcpy(log->data + log->size, entry, n);
+    log->size += n;
+    log->n_events++;
+    log->last_frame = frame;
+}
+
+// Size of the leading events of the log that fit in max_size bytes, n_events gets their count
+uint32_t event_log_prefix(event_log *log, uint32_t max_size, uint32_t *n_events) {
+    uint32_t size = 0;
+    *n_events = 0;
+    while (size < log->size) {
+        uint32_t end = size;
+        while (log->data[end] & 0x80) end++;
+        end += 2; // last delta byte and the lane byte
+        if (end > max_size) break;
+        size = end;
+        (*n_events)++;
+    }
+    return size;
+}
+
+// Binary outcard layout, little endian:
+// "RHYB", version (u8), frame (u32), score (i32), notes_interval (u8), speed (f32),
+// max_combo, max_combo_score, n_perfect, n_nice, n_good, n_miss (bads included), n_bad (u32 each), end_reason (u8),
+// latency (i32, in 1/256 frames), and once the game ended the event log:
+// n_events, n_dropped, start_frame, size (u32 each) and size bytes of events.
+// Events that don't fit the outcard are left out and counted in n_dropped.
+void write_binary_outcard(game_state *game, int64_t values[N_OUTCARD_FIELDS]) {
+    uint8_t *out = riv->outcard;
+    int len = 0;
+    memcpy(out, "RHYB", MAGIC_SIZE);
+    len += MAGIC_SIZE;
+    out[len++] = OUTCARD_BINARY_VERSION;
+    for (int f = 0; f < N_OUTCARD_FIELDS; f++) {
+        int n_bytes = (f == OUTCARD_NOTES_INTERVAL || f == OUTCARD_END_REASON) ? 1 : 4;
+        put_le(out + len, (uint64_t)values[f], n_bytes);
+        len += n_bytes;
+    }
+    if (values[OUTCARD_END_REASON] != NOT_ENDED) {
+        event_log *log = &game->events;
+        uint32_t n_events;
+        uint32_t size = event_log_prefix(log, RIV_SIZE_OUTCARD - len - 16, &n_events);
+        uint32_t header[4] = {n_events, log->n_dropped + log->n_events - n_events, (uint32_t)log->start_frame, size};
+        for (int i = 0; i < 4; i++) {
+            put_le(out + len, header[i], 4);
+            len += 4;
         }
-        uint64_t n_notes_x = maxu(sound->source->track_sizes[t], SEQT_NOTES_COLUMNS);
-        for (int x = 0; x < n_notes_x; x++) {
-            if (x % notes_interval == 0) {
-                for (int y = 0; y < SEQT_NOTES_ROWS; y++) {
-                    if (sound->source->pages[t][y][x].periods > 0) {
-                        row_has_note[y] = true;
-                    }
-                }
-            }
+        memcpy(out + len, log->data, size);
+        len += size;
+    }
+    riv->outcard_len = len;
+}
+
+// appends "events":{"n_events":n,"n_dropped":n,"start_frame":n,"size":n,"data":"base64"}
+// within space bytes, the events that don't fit are left out and counted in n_dropped
+int write_event_log_outcard(game_state *game, char *out, int space) {
+    static const char base64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    event_log *log = &game->events;
+    uint32_t n_events;
+    uint32_t max_size = space > OUTCARD_EVENTS_HEADER_SIZE ? (space - OUTCARD_EVENTS_HEADER_SIZE) / 4 * 3 : 0;
+    uint32_t size = event_log_prefix(log, max_size, &n_events);
+    const char *keys[4] = {",\"events\":{\"n_events\":", ",\"n_dropped\":", ",\"start_frame\":", ",\"size\":"};
+    int64_t values[4] = {n_events, log->n_dropped + log->n_events - n_events, log->start_frame, size};
+    int len = 0;
+    for (int i = 0; i < 4; i++) {
+        int key_len = strlen(keys[i]);
+        memcpy(out + len, keys[i], key_len);
+        len += key_len;
+        len += format_int(out + len, values[i]);
+    }
+    memcpy(out + len, ",\"data\":\"", 9);
+    len += 9;
+    for (uint32_t i = 0; i < size; i += 3) {
+        uint32_t n = size - i < 3 ? size - i : 3;
+        uint32_t bits = log->data[i] << 16;
+        if (n > 1) bits |= log->data[i+1] << 8;
+        if (n > 2) bits |= log->data[i+2];
+        out[len++] = base64[(bits >> 18) & 0x3f];
+        out[len++] = base64[(bits >> 12) & 0x3f];
+        out[len++] = n > 1 ? base64[(bits >> 6) & 0x3f] : '=';
+        out[len++] = n > 2 ? base64[bits & 0x3f] : '=';
+    }
+    memcpy(out + len, "\"}", 2);
+    len += 2;
+    return len;
+}
 
+#ifdef PROFILE
+// appends "profile":{"scope":[min,avg,max],...} for the scopes that ran
+int write_profile_outcard(game_state *game, char *out) {
+    const char *key = ",\"profile\":{";
+    int len = strlen(key);
+    memcpy(out, key, len);
+    bool first = true;
+    for (int s = 0; s < N_PROFILE_SCOPES; s++) {
+        profile_stats *stats = &game->profile.total[s];
+        if (stats->n == 0) continue;
+        if (!first) out[len++] = ',';
+        first = false;
+        out[len++] = '"';
+        int name_len = strlen(profile_names[s]);
+        memcpy(out + len, profile_names[s], name_len);
+        len += name_len;
+        memcpy(out + len, "\":[", 3);
+        len += 3;
+        len += format_int(out + len, stats->min);
+        out[len++] = ',';
+        len += format_int(out + len, stats->sum / stats->n);
+        out[len++] = ',';
+        len += format_int(out + len, stats->max);
+        out[len++] = ']';
+    }
+    out[len++] = '}';
+
+    const char *worst_key = ",\"worst_frames\":[";
+    int worst_key_len = strlen(worst_key);
+    memcpy(out + len, worst_key, worst_key_len);
+    len += worst_key_len;
+    for (int i = 0; i < game->profile.n_worst; i++) {
+        profile_frame *worst = &game->profile.worst[i];
+        if (i > 0) out[len++] = ',';
+        memcpy(out + len, "{\"frame\":", 9);
+        len += 9;
+        len += format_int(out + len, worst->frame);
+        memcpy(out + len, ",\"cycles\":", 10);
+        len += 10;
+        len += format_int(out + len, worst->cycles);
+        memcpy(out + len, ",\"phase\":\"", 10);
+        len += 10;
+        int name_len = strlen(profile_names[worst->phase]);
+        memcpy(out + len, profile_names[worst->phase], name_len);
+        len += name_len;
+        memcpy(out + len, "\"}", 2);
+        len += 2;
+    }
+    out[len++] = ']';
+    return len;
+}
+#endif
+
+_Static_assert(OUTCARD_FIELDS_SIZE + OUTCARD_EVENTS_HEADER_SIZE + OUTCARD_PROFILE_SIZE <= RIV_SIZE_OUTCARD, "outcard too small");
+
+// Write the game stats to the outcard, fields are reformatted only when they change
+void write_outcard(game_state *game, uint8_t end_reason) {
+    uint32_t speed_bits;
+    memcpy(&speed_bits, &game->new_tile_speed, sizeof(speed_bits));
+    int64_t values[N_OUTCARD_FIELDS] = {
+        (int)riv->frame, game->score, game->notes_interval, speed_bits, game->max_combo, game->max_combo_score,
+        game->n_perfects, game->n_nice, game->n_good, game->n_miss, game->n_bad, end_reason, game->latency,
+    };
+    if (game->binary_outcard) {
+        write_binary_outcard(game, values);
+        return;
+    }
+
+    outcard_cache *cache = &game->outcard;
+    for (int f = 0; f < N_OUTCARD_FIELDS; f++) {
+        if (cache->valid && cache->values[f] == values[f]) continue;
+        cache->values[f] = values[f];
+        if (f == OUTCARD_SPEED) {
+            cache->lens[f] = riv_snprintf(cache->texts[f], OUTCARD_TEXT_SIZE, "%.5f", game->new_tile_speed);
+        } else {
+            cache->lens[f] = format_int(cache->texts[f], values[f]);
         }
-        uint8_t arrow_cols = 0;
+    }
+    cache->valid = true;
+
+    char *out = (char*)riv->outcard;
+    int len = 0;
+    for (int f = 0; f < N_OUTCARD_FIELDS; f++) {
+        int key_len = strlen(outcard_keys[f]);
+        memcpy(out + len, outcard_keys[f], key_len);
+        len += key_len;
+        memcpy(out + len, cache->texts[f], cache->lens[f]);
+        len += cache->lens[f];
+    }
+    // the fields fit in OUTCARD_FIELDS_SIZE, the log gets what the profile and the end leave
+#ifdef PROFILE
+    int tail = OUTCARD_PROFILE_SIZE + 2;
+#else
+    int tail = 2;
+#endif
+    if (end_reason != NOT_ENDED) len += write_event_log_outcard(game, out + len, RIV_SIZE_OUTCARD - len - tail);
+#ifdef PROFILE
+    if (end_reason != NOT_ENDED) len += write_profile_outcard(game, out + len);
+#endif
+    out[len++] = '}';
+    out[len] = '\0';
+    riv->outcard_len = len;
+}
+
+#ifdef PROFILE
+// Worst case song: every row of every column of all tracks, longest notes,
+// one note step per frame so the chart spawns on every frame
+seqt_source *make_stress_source(void) {
+    seqt_source *source = calloc(1, sizeof(seqt_source));
+    if (!source) return NULL;
+    memcpy(source->magic, "SEQT", MAGIC_SIZE);
+    source->bpm = (int16_t)(60 * riv->target_fps / TIME_SIG);
+    for (int t = 0; t < SEQT_NOTES_TRACKS; t++) {
+        source->track_sizes[t] = SEQT_NOTES_TOTAL_COLUMNS;
         for (int y = 0; y < SEQT_NOTES_ROWS; y++) {
-            if (row_has_note[y]) {
-                notes_y_cols_mapping[t][y] = arrow_cols%n_cols;
-                arrow_cols++;
+            for (int x = 0; x < SEQT_NOTES_TOTAL_COLUMNS; x++) {
+                source->pages[t][y][x] = (seqt_note){.periods = INT8_MAX, .slide = 1};
             }
         }
     }
+    return source;
 }
-void initialize() {
 
-    seqt_init();
-    if (riv->incard_len > 0) {
-        read_incard_data(riv->incard,0,riv->incard_len);
+// Hit every lane key and its alternative on every frame
+void mash_all_keys(void) {
+    for (int c = 0; c < MAX_COLS; c++) {
+        riv->keys[key_codes[c]].down = riv->keys[key_codes[c]].press = true;
+        riv->keys[alternative_key_codes[c]].down = riv->keys[alternative_key_codes[c]].press = true;
+    }
+    riv->keys[RIV_GAMEPAD1_A1].press = true;
+}
+#endif
+
+void initialize(game_state *game) {
+
+    seqt_init(&game->seqt);
+#ifdef PROFILE
+    if (game->stress) {
+        game->n_cols = MAX_COLS;
+        game->notes_interval = 1;
+        game->max_misses = 0;
+        seqt_source *source = make_stress_source();
+        if (source) {
+            game->songs[game->n_songs++] = (catalog_song){
+                .source = source,
+                .size = sizeof(seqt_source),
+                .hash = word_hash((uint8_t*)source, sizeof(seqt_source)),
+            };
+        }
+    }
+#endif
+    if (game->n_songs == 0 && riv->incard_len > 0) {
+        read_incard_data(game, riv->incard, riv->incard_len);
     }
 
-    if (n_sounds == 0) {
-        sound_ids[n_sounds] = seqt_play(seqt_make_source_from_file("seqs/f6.seqt.01.rivcard"), n_loops);
-        sound_hashes[n_sounds] = simple_hash((unsigned char*)seqt_get_sound(sound_ids[n_sounds])->source,sizeof(seqt_source));
-        n_sounds++;
+    if (game->n_songs == 0) {
+        seqt_source *source = seqt_make_source_from_file("seqs/f6.seqt.01.rivcard");
+        if (source) {
+            game->songs[game->n_songs++] = (catalog_song){
+                .source = source,
+                .size = sizeof(seqt_source),
+                .hash = word_hash((uint8_t*)source, sizeof(seqt_source)),
+                .mapped = true,
+            };
+        }
     }
 
-    int total_blanks_x_px = SCREEN_SIZE - n_cols * TILE_SIZE;
-    int spaces_x_px = total_blanks_x_px / (n_cols + 1);
-    int leftover_spaces_x_px = (total_blanks_x_px - spaces_x_px*(n_cols + 1)) / 2 ;
+    int total_blanks_x_px = SCREEN_SIZE - game->n_cols * TILE_SIZE;
+    int spaces_x_px = total_blanks_x_px / (game->n_cols + 1);
+    int leftover_spaces_x_px = (total_blanks_x_px - spaces_x_px*(game->n_cols + 1)) / 2 ;
 
     int col_inds[MAX_COLS];
-    for (int c = 0; c < n_cols; c++) col_inds[c] = c;
+    for (int c = 0; c < game->n_cols; c++) col_inds[c] = c;
 
     // bubble sort
     bool swapped;
     do {
         swapped = false;
-        for (int c = 1; c < n_cols; c++) {
+        for (int c = 1; c < game->n_cols; c++) {
             if (col_sprite_order[col_inds[c-1]] > col_sprite_order[col_inds[c]]) { //swap
                 int aux_ind = col_inds[c-1];
                 col_inds[c-1] = col_inds[c];
@@ -257,299 +1070,611 @@ void initialize() {
         }
     } while (swapped);
 
-    x_cols[col_inds[0]] = spaces_x_px + leftover_spaces_x_px;
-    for (int c = 1; c < n_cols; c++) {
-        x_cols[col_inds[c]] = spaces_x_px + (TILE_SIZE + spaces_x_px) * c;
+    game->x_cols[col_inds[0]] = spaces_x_px + leftover_spaces_x_px;
+    for (int c = 1; c < game->n_cols; c++) {
+        game->x_cols[col_inds[c]] = spaces_x_px + (TILE_SIZE + spaces_x_px) * c;
     }
 
     // initialize start animation
     int frames_distance_animation = 2 * TILE_SIZE;
-    for (int c = 0; c < n_cols; c++) sliding_arrows[col_inds[c]][SCREEN_SIZE - 1] = - frames_distance_animation*(c + 1);
-    for (int c = 0; c < n_cols; c++) sliding_arrows[col_inds[c]][SCREEN_SIZE - 1 - TILE_SIZE] = - frames_distance_animation*(1 + n_cols + c );
+    // the animation arrows are never hit, their spawn frame orders them
+    for (int c = 0; c < game->n_cols; c++) {
+        int frame = - frames_distance_animation*(c + 1);
+        lane_push(&game->sliding_arrows[col_inds[c]], frame, SCREEN_SIZE - 1, frame);
+    }
+    for (int c = 0; c < game->n_cols; c++) {
+        int frame = - frames_distance_animation*(1 + game->n_cols + c );
+        lane_push(&game->sliding_arrows[col_inds[c]], frame, SCREEN_SIZE - 1 - TILE_SIZE, frame);
+    }
 
-    riv->outcard_len = riv_snprintf((char*)riv->outcard, RIV_SIZE_OUTCARD,
-        "JSON{\"frame\":%d,\"score\":%d,\"notes_interval\":%d,\"speed\":%.5f,\"max_combo\":%d,\"max_combo_score\":%d,\"n_perfect\":%d,\"n_nice\":%d,\"n_good\":%d,\"n_miss\":%d,\"n_bad\":%d,\"end_reason\":%d}",
-        riv->frame, score, notes_interval, new_tile_speed, max_combo, max_combo_score,n_perfects,n_nice,n_good,n_miss,n_bad,NOT_ENDED);
+    write_outcard(game, NOT_ENDED);
 }
 
-void random_wait() {
-    random_wait_frame = riv->frame + riv_rand_uint(riv->target_fps/2);
-    wait = true;
+// Calibration song: a metronome on the drum track, high click on the first beat of each bar
+seqt_source *make_click_source(void) {
+    seqt_source *source = calloc(1, sizeof(seqt_source));
+    if (!source) return NULL;
+    memcpy(source->magic, "SEQT", MAGIC_SIZE);
+    source->bpm = CALIBRATION_BPM;
+    source->track_sizes[CLICK_TRACK] = SEQT_NOTES_COLUMNS;
+    for (int x = 0; x < SEQT_NOTES_COLUMNS; x += SEQT_TIME_SIG) {
+        int row = x % (SEQT_TIME_SIG*TIME_SIG) == 0 ? HIGHCLICK_ROW : CLICK_ROW;
+        source->pages[CLICK_TRACK][row][x] = (seqt_note){.periods = 1};
+    }
+    return source;
 }
 
-// Called when game starts
-void start_game() {
-    riv_printf("GAME START\n");
+// latencies are kept within half a calibration beat, the nearest click is ambiguous past it
+int clamp_latency(int latency) {
+    int max_latency = LATENCY_ONE * riv->target_fps * 60 / CALIBRATION_BPM / 2;
+    return latency < -max_latency ? -max_latency : latency > max_latency ? max_latency : latency;
+}
 
-    for (int c = 0; c < n_cols; c++) {
-        for (int i=0; i < SCREEN_SIZE; i++) {
-            sliding_arrows[c][i] = 0;
-        }
+// sorted press offsets are averaged without the earliest and latest quarters,
+// so a few wild presses don't move the result (all in 1/LATENCY_ONE frames)
+int estimate_latency(int *offsets, int n) {
+    for (int i = 1; i < n; i++) {
+        int offset = offsets[i];
+        int j = i;
+        for (; j > 0 && offsets[j-1] > offset; j--) offsets[j] = offsets[j-1];
+        offsets[j] = offset;
     }
+    int sum = 0;
+    for (int i = n/4; i < n - n/4; i++) sum += offsets[i];
+    return clamp_latency((int)lround((double)sum / (n - 2*(n/4))));
+}
 
-    started = true;
+void start_calibration(game_state *game) {
+    if (!game->calibration_source) game->calibration_source = make_click_source();
+    game->calibration_sound = seqt_play(&game->seqt, game->calibration_source, -1);
+    seqt_sound *sound = seqt_get_sound(&game->seqt, game->calibration_sound);
+    if (!sound) return;
+    riv_printf("CALIBRATION START\n");
+    // the click sound is polled from the next frame on, starting at its frame 1
+    game->calibration_clock = sound->clock;
+    game->calibration_start_frame = riv->frame;
+    game->n_calibration_offsets = 0;
+    game->calibrating = true;
+}
 
-    for (int i = 0; i < n_sounds; i++) {
-        uint64_t sound_id = sound_ids[i];
-        if (sound_id != chosen_sound) {
-            seqt_destroy_source(seqt_get_sound(sound_id)->source);
-        }
+void end_calibration(game_state *game) {
+    seqt_stop(&game->seqt, game->calibration_sound);
+    game->calibrating = false;
+    // replay the chosen song preview
+    seqt_set_start(&game->seqt, game->chosen_sound,0.2);
+    seqt_seek(&game->seqt, game->chosen_sound,0.0);
+}
+
+void update_calibration(game_state *game) {
+    if (riv->keys[RIV_GAMEPAD1_SELECT].press) {
+        end_calibration(game);
+        return;
+    }
+    seqt_sound *sound = seqt_get_sound(&game->seqt, game->calibration_sound);
+    if (!sound) {
+        end_calibration(game);
+        return;
+    }
+    PROFILE_BEGIN(PROFILE_MUSIC);
+    seqt_poll_sound(sound);
+    PROFILE_END(game, PROFILE_MUSIC);
+
+    bool pressed = false;
+    for (int c = 0; c < MAX_COLS; c++) {
+        if (riv->keys[key_codes[c]].press || riv->keys[alternative_key_codes[c]].press) pressed = true;
     }
+    if (!pressed) return;
+
+    // offset from the frame the nearest click is heard, the first click only leads in
+    uint64_t frame = riv->frame - game->calibration_start_frame;
+    uint64_t beat = seqt_clock_seek(&game->calibration_clock, frame) / SEQT_TIME_SIG;
+    uint64_t beat_frame = seqt_clock_step_frame(&game->calibration_clock, beat*SEQT_TIME_SIG);
+    uint64_t next_beat_frame = seqt_clock_step_frame(&game->calibration_clock, (beat + 1)*SEQT_TIME_SIG);
+    if (next_beat_frame - frame < frame - beat_frame) {
+        beat++;
+        beat_frame = next_beat_frame;
+    }
+    if (beat == 0) return;
+    game->calibration_offsets[game->n_calibration_offsets++] = ((int)frame - (int)beat_frame) * LATENCY_ONE;
+
+    if (game->n_calibration_offsets == CALIBRATION_PRESSES) {
+        game->latency = estimate_latency(game->calibration_offsets, CALIBRATION_PRESSES);
+        riv_printf("CALIBRATION END\n");
+        end_calibration(game);
+    }
+}
 
-    int16_t music_bpm = seqt_get_sound(chosen_sound)->source->bpm;
-    hits_per_second = music_bpm*((1.0*TIME_SIG)/60); // beats per second
-    note_period = hits_per_second/riv->target_fps;
-    frames_per_beat = riv->target_fps/(music_bpm/60.0);
+void random_wait(game_state *game) {
+    game->random_wait_frame = riv->frame + riv_rand_uint(riv->target_fps/2);
+    game->wait = true;
+}
+
+// Called when game starts
+void start_game(game_state *game) {
+    riv_printf("GAME START\n");
 
-    tile_speed = new_tile_speed;
+    for (int c = 0; c < game->n_cols; c++) lane_clear(&game->sliding_arrows[c]);
 
-    frames_until_mark = (int)round(N_SLIDING_TILES*TILE_SIZE/new_tile_speed);
+    game->started = true;
+    game->events.start_frame = game->events.last_frame = riv->frame;
 
-    seqt_set_start(chosen_sound,((double)frames_until_mark)/riv->target_fps);
-    seqt_seek(chosen_sound,0.0);
+    seqt_sound *sound = seqt_get_sound(&game->seqt, game->chosen_sound);
+    game->chart_clock = seqt_make_clock(sound->source->bpm, sound->speed, riv->target_fps);
 
+    game->tile_speed = game->new_tile_speed;
 
-    update_notes_mapping();
+    game->frames_until_mark = (int)round(N_SLIDING_TILES*TILE_SIZE/game->new_tile_speed);
+
+    seqt_set_start(&game->seqt, game->chosen_sound,((double)game->frames_until_mark)/riv->target_fps);
+    seqt_seek(&game->seqt, game->chosen_sound,0.0);
+
+    // compile the chart, starting on the next game frame
+    game->chart_start_frame = riv->frame + 1;
+    game->chart_step = 0;
+    game->chart_done = false;
+    game->chart_new_tile_speed = game->new_tile_speed;
+    game->chart_notes_interval = game->notes_interval;
+    compile_chart(game);
 }
 
 // Called when game ends
-void end_game() {
+void end_game(game_state *game) {
     riv_printf("GAME OVER\n");
-    ended = true;
+    game->ended = true;
 
     // final oucard
-    riv->outcard_len = riv_snprintf((char*)riv->outcard, RIV_SIZE_OUTCARD,
-        "JSON{\"frame\":%d,\"score\":%d,\"notes_interval\":%d,\"speed\":%.5f,\"max_combo\":%d,\"max_combo_score\":%d,\"n_perfect\":%d,\"n_nice\":%d,\"n_good\":%d,\"n_miss\":%d,\"n_bad\":%d,\"end_reason\":%d}",
-        riv->frame, score, notes_interval, new_tile_speed, max_combo, max_combo_score,n_perfects,n_nice,n_good,n_miss,n_bad,end_reason);
+    write_outcard(game, game->end_reason);
 
+#ifdef HEADLESS
+    // Nothing left to show, quit right away so batch verifications don't replay the ending
+    riv->quit_frame = riv->frame;
+#else
     // Quit in 2 seconds
     riv->quit_frame = riv->frame + 2*riv->target_fps;
+#endif
 }
 
-bool update_score(int state) {
+bool update_score(game_state *game, int state) {
     float multiplier = 0;
     switch (state) {
     case STATE_PERFECT:
-        combo_moves++;
-        consecutive_misses = 0;
-        multiplier = (1.0 + (combo_moves * 0.1)) * perfect_multiplier;
-        n_perfects++;
+        game->combo_moves++;
+        game->consecutive_misses = 0;
+        multiplier = (1.0 + (game->combo_moves * 0.1)) * game->perfect_multiplier;
+        game->n_perfects++;
         break;
     case STATE_NICE:
-        combo_moves++;
-        consecutive_misses = 0;
-        multiplier = (1.0 + (combo_moves * 0.1)) * nice_multiplier;
-        n_nice++;
+        game->combo_moves++;
+        game->consecutive_misses = 0;
+        multiplier = (1.0 + (game->combo_moves * 0.1)) * game->nice_multiplier;
+        game->n_nice++;
         break;
     case STATE_GOOD:
-        combo_moves++;
-        consecutive_misses = 0;
-        multiplier = (1.0 + (combo_moves * 0.1)) * good_multiplier;
-        n_good++;
+        game->combo_moves++;
+        game->consecutive_misses = 0;
+        multiplier = (1.0 + (game->combo_moves * 0.1)) * game->good_multiplier;
+        game->n_good++;
         break;
     case STATE_BAD:
-        combo_moves = 0;
-        consecutive_misses++;
-        n_bad++;
+        game->combo_moves = 0;
+        game->consecutive_misses++;
+        game->n_bad++;
+        // a bad press also counts as a miss (the event log keeps them apart)
+        // fall through
     case STATE_MISS:
-        combo_moves = 0;
-        consecutive_misses++;
-        n_miss++;
+        game->combo_moves = 0;
+        game->consecutive_misses++;
+        game->n_miss++;
+        // fall through
     default:
         return false; 
     }
     int press_score = ceil(100 * multiplier);
-    if (combo_moves > max_combo) max_combo = combo_moves;
-    if (press_score > max_combo_score) max_combo_score = press_score;
-    score += press_score;
+    if (game->combo_moves > (uint64_t)game->max_combo) game->max_combo = game->combo_moves;
+    if (press_score > game->max_combo_score) game->max_combo_score = press_score;
+    game->score += press_score;
     return true;
 }
 
 // Update game logic
-void update_game() {
+void update_game(game_state *game) {
     // end game
-    seqt_sound *sound = seqt_get_sound(chosen_sound);
+    seqt_sound *sound = seqt_get_sound(&game->seqt, game->chosen_sound);
     // seqt_sound *sound = &seqt.sounds[chosen_sound];
-    if (riv->keys[RIV_GAMEPAD1_SELECT].press || (max_misses > 0 && consecutive_misses >= max_misses) || !sound) {
+    if (riv->keys[RIV_GAMEPAD1_SELECT].press || (game->max_misses > 0 && game->consecutive_misses >= (uint64_t)game->max_misses) || !sound) {
         if (riv->keys[RIV_GAMEPAD1_SELECT].press) {
-            end_reason = FORCED_END;
-        } else if (max_misses > 0 && consecutive_misses >= max_misses) {
-            end_reason = MISSES_END;
+            game->end_reason = FORCED_END;
+        } else if (game->max_misses > 0 && game->consecutive_misses >= (uint64_t)game->max_misses) {
+            game->end_reason = MISSES_END;
         } else if (!sound) {
-            end_reason = MUSIC_END;
+            game->end_reason = MUSIC_END;
         }
-        end_game();
+        end_game(game);
         return;
     }
 
     // reset pressed
-    perfect_hit = false;
-    nice_hit = false;
-    good_hit = false;
-    for (int c = 0; c < n_cols; c++) {
-        pressed[c] = false;
-        pressed_match[c] = STATE_NOTHING;
+    game->perfect_hit = false;
+    game->nice_hit = false;
+    game->good_hit = false;
+    for (int c = 0; c < game->n_cols; c++) {
+        game->pressed[c] = false;
+        game->pressed_match[c] = STATE_NOTHING;
     }
 
     // detect colums presses and misses
-    for (int c = 0; c < n_cols; c++) {
+    int latency_rest = game->latency - latency_frames(game)*LATENCY_ONE;
+    for (int c = 0; c < game->n_cols; c++) {
+        PROFILE_BEGIN(PROFILE_JUDGEMENT);
         // update animation
-        if (animation_frames[c]) animation_frames[c]--;
-        else animation_match[c] = 0;
+        if (game->animation_frames[c]) game->animation_frames[c]--;
+        else game->animation_match[c] = 0;
 
         // detect pressed
-        if (riv->keys[key_codes[c]].down) pressed[c] = true;
-        else if (riv->keys[alternative_key_codes[c]].down) pressed[c] = true;
-
-        bool left_screen = false;
-        for (int i = 0; i < SCREEN_SIZE; i++) {
-            if (sliding_arrows[c][i]) {
-                // check match press
-                bool match = false;
-                if (!pressed_match[c] && (riv->keys[key_codes[c]].press || riv->keys[alternative_key_codes[c]].press)) {
-                    // distance from sliding to arrow
-                    int distance = abs(i - TOP_Y);
-                    if (distance < PERFECT_DISTANCE) {
-                        pressed_match[c] = STATE_PERFECT;
-                        match = true;
-                        perfect_hit = true;
-                        animation_frames[c] = N_ANIMATION_FRAMES;
-                        animation_match[c] = STATE_PERFECT;
-                    } else if (distance < NICE_DISTANCE) {
-                        pressed_match[c] = STATE_NICE;
-                        match = true;
-                        nice_hit = true;
-                        animation_frames[c] = N_ANIMATION_FRAMES;
-                        animation_match[c] = STATE_NICE;
-                    } else if (distance < GOOD_DISTANCE) {
-                        pressed_match[c] = STATE_GOOD;
-                        match = true;
-                        good_hit = true;
-                        animation_frames[c] = N_ANIMATION_FRAMES;
-                        animation_match[c] = STATE_GOOD;
-                    } else {
-                        pressed_match[c] = STATE_BAD;
-                        animation_frames[c] = N_ANIMATION_FRAMES;
-                        animation_match[c] = STATE_BAD;
-                    }
-                    update_score(pressed_match[c]);
-                }
-
-                if (!match) {
-
-                    float s = sliding_arrows[c][i] > frame_increase_speed ? new_tile_speed : tile_speed;
-                    int new_ind = (int)round(SCREEN_SIZE - 1 - (riv->frame - sliding_arrows[c][i]) * s);
-                    if (new_ind == i) continue;
-                    if (new_ind >= 0) {
-                        sliding_arrows[c][new_ind] = sliding_arrows[c][i];
-                    } else {
-                        left_screen = true;
-                    }
-                }
-                sliding_arrows[c][i] = 0;
+        if (riv->keys[key_codes[c]].down) game->pressed[c] = true;
+        else if (riv->keys[alternative_key_codes[c]].down) game->pressed[c] = true;
+
+        // only the earliest arrow of the lane can be judged
+        lane_queue *lane = &game->sliding_arrows[c];
+        if (lane->count > 0 && (riv->keys[key_codes[c]].press || riv->keys[alternative_key_codes[c]].press)) {
+            // frames from the arrow target, moved by the latency left after the spawn shift
+            int distance = abs(((int)riv->frame - lane_at(lane,0)->target)*LATENCY_ONE - latency_rest);
+            bool match = false;
+            if (distance < game->perfect_window*LATENCY_ONE) {
+                game->pressed_match[c] = STATE_PERFECT;
+                match = true;
+                game->perfect_hit = true;
+                game->animation_frames[c] = N_ANIMATION_FRAMES;
+                game->animation_match[c] = STATE_PERFECT;
+            } else if (distance < game->nice_window*LATENCY_ONE) {
+                game->pressed_match[c] = STATE_NICE;
+                match = true;
+                game->nice_hit = true;
+                game->animation_frames[c] = N_ANIMATION_FRAMES;
+                game->animation_match[c] = STATE_NICE;
+            } else if (distance < game->good_window*LATENCY_ONE) {
+                game->pressed_match[c] = STATE_GOOD;
+                match = true;
+                game->good_hit = true;
+                game->animation_frames[c] = N_ANIMATION_FRAMES;
+                game->animation_match[c] = STATE_GOOD;
+            } else {
+                game->pressed_match[c] = STATE_BAD;
+                game->animation_frames[c] = N_ANIMATION_FRAMES;
+                game->animation_match[c] = STATE_BAD;
             }
+            update_score(game, game->pressed_match[c]);
+            log_event(&game->events, riv->frame, c, game->pressed_match[c]);
+            if (match) lane_pop(lane);
         }
-        if (left_screen) {
-            pressed_match[c] = STATE_MISS;
-            animation_frames[c] = N_ANIMATION_FRAMES;
-            animation_match[c] = STATE_MISS;
-            update_score(STATE_MISS);
+        PROFILE_END(game, PROFILE_JUDGEMENT);
+
+        // arrows may scroll off the top while they can still be hit, they leave once their window passed
+        PROFILE_BEGIN(PROFILE_ARROWS);
+        lane_advance(game, lane, INT_MIN);
+        PROFILE_END(game, PROFILE_ARROWS);
+        // every arrow whose window passed is a miss of its own
+        while (lane->count > 0 && ((int)riv->frame - lane_at(lane,0)->target)*LATENCY_ONE - latency_rest >= game->good_window*LATENCY_ONE) {
+            lane_pop(lane);
+            game->pressed_match[c] = STATE_MISS;
+            game->animation_frames[c] = N_ANIMATION_FRAMES;
+            game->animation_match[c] = STATE_MISS;
+            update_score(game, STATE_MISS);
+            log_event(&game->events, riv->frame, c, STATE_MISS);
         }
-        if (!pressed_match[c] && (riv->keys[key_codes[c]].press || riv->keys[alternative_key_codes[c]].press)) {
-            pressed_match[c] = STATE_BAD;
-            animation_frames[c] = N_ANIMATION_FRAMES;
-            animation_match[c] = STATE_BAD;
-            update_score(STATE_BAD);
+        if (!game->pressed_match[c] && (riv->keys[key_codes[c]].press || riv->keys[alternative_key_codes[c]].press)) {
+            game->pressed_match[c] = STATE_BAD;
+            game->animation_frames[c] = N_ANIMATION_FRAMES;
+            game->animation_match[c] = STATE_BAD;
+            update_score(game, STATE_BAD);
+            log_event(&game->events, riv->frame, c, STATE_BAD);
         }
     }
 
     // update tick position
-    for (int t = 0; t < MAX_TICKS; t++) {
-        for (int i = 0; i < SCREEN_SIZE; i++) {
-            if (sliding_ticks[t][i]) {
-                float s = sliding_ticks[t][i] > frame_increase_speed ? new_tile_speed : tile_speed;
-                int new_ind = (int)round(SCREEN_SIZE - 1 - (riv->frame - sliding_ticks[t][i]) * s);
-                if (new_ind == i) continue;
-                if (new_ind >= 0) {
-                    sliding_ticks[t][new_ind] = sliding_ticks[t][i];
-                }
-                sliding_ticks[t][i] = 0;
-            }
+    PROFILE_BEGIN(PROFILE_TICKS);
+    for (int t = 0; t < MAX_TICKS; t++) lane_advance(game, &game->sliding_ticks[t], 0);
+    PROFILE_END(game, PROFILE_TICKS);
+
+    // add new arrows and apply difficulty changes from the chart
+    PROFILE_BEGIN(PROFILE_SPAWN);
+    while (true) {
+        if (game->chart_cursor == game->chart_len) {
+            if (game->chart_done) break;
+            PROFILE_BEGIN(PROFILE_CHART);
+            compile_chart(game);
+            PROFILE_END(game, PROFILE_CHART);
+            if (game->chart_len == 0) break;
+        }
+        chart_event *event = &game->chart[game->chart_cursor];
+        if (event->frame > (int)riv->frame) break;
+        switch (event->type) {
+        case CHART_TICK:
+            lane_push(&game->sliding_ticks[event->lane], riv->frame, SCREEN_SIZE-1, event->target);
+            break;
+        case CHART_ARROW:
+            lane_push(&game->sliding_arrows[event->lane], riv->frame, SCREEN_SIZE-1, event->target);
+            break;
+        case CHART_SPEED_CHANGE:
+            game->tile_speed = game->new_tile_speed;
+            game->new_tile_speed = bound_speed(game->tile_speed_modifier * game->tile_speed);
+            game->frame_increase_speed = riv->frame;
+            break;
+        case CHART_INTERVAL_CHANGE:
+            game->notes_interval = game->notes_interval -1;
+            break;
         }
+        game->chart_cursor++;
     }
+    PROFILE_END(game, PROFILE_SPAWN);
 
-    // add new arrows
-    int note_to_evaluate = get_note_frame(sound->frame+frames_until_mark+fix_frame);
+    // play music
+    PROFILE_BEGIN(PROFILE_MUSIC);
+    seqt_poll_sound(sound);
+    PROFILE_END(game, PROFILE_MUSIC);
 
-    if (note_to_evaluate > last_note_evaluated) {
-        // add beat/hit tick
-        if (note_to_evaluate % SEQT_TIME_SIG != 0) {
-            sliding_ticks[HIT_TICK][SCREEN_SIZE-1] = riv->frame;
-        } else {
-            sliding_ticks[BEAT_TICK][SCREEN_SIZE-1] = riv->frame;
-        }
+    // update outcard
+    PROFILE_BEGIN(PROFILE_OUTCARD);
+    write_outcard(game, NOT_ENDED);
+    PROFILE_END(game, PROFILE_OUTCARD);
+}
 
-        // add arrow
-        if (note_to_evaluate % notes_interval == 0) {
-            for (uint64_t note_y = 0; note_y < SEQT_NOTES_ROWS; ++note_y) {
-                seqt_note note = sound->source->pages[focus_track][note_y][get_note_x(focus_track,note_to_evaluate)];
-                if (note.periods > 0) {
-                    sliding_arrows[notes_y_cols_mapping[focus_track][note_y]][SCREEN_SIZE-1] = riv->frame;
-                }
-            }
-        }
-        
-        // update speed difficulty
-        counter_last_speed_change++;
-        if (speed_increase_interval > 0 && 
-                counter_last_speed_change/SEQT_NOTES_COLUMNS >= speed_increase_interval &&
-                riv->frame > frame_increase_speed_buffer) {
-            tile_speed = new_tile_speed;
-            new_tile_speed = tile_speed_modifier * tile_speed;
-            frame_increase_speed = riv->frame;
-            frame_increase_speed_buffer = riv->frame + frames_until_mark;
-            frames_until_mark = (int)round(N_SLIDING_TILES*TILE_SIZE/new_tile_speed);
-            counter_last_speed_change = 0;
-        }
+// snapshots
+typedef struct snapshot_io {
+    uint8_t *data;
+    size_t size;
+    size_t len;
+    bool load;
+    bool ok;
+    uint8_t has_sound;
+    seqt_sound sound; // loaded music position, applied once the song is active
+} snapshot_io;
+
+void snapshot_field(snapshot_io *io, void *value, size_t n) {
+    if (io->len + n <= io->size) {
+        if (io->load) memcpy(value, io->data + io->len, n);
+        else memcpy(io->data + io->len, value, n);
+    } else if (io->load) {
+        io->ok = false;
+        return;
+    }
+    io->len += n;
+}
 
-        // update notes interval difficulty
-        counter_last_interval_change++;
-        if (notes_increase_interval > 0 && counter_last_interval_change/SEQT_NOTES_COLUMNS >= notes_increase_interval) {
-            if (notes_interval > 1) {
-                notes_interval = notes_interval -1;
-                update_notes_mapping();
-            }
-            counter_last_interval_change = 0;
-        }
-        
-        // change track
-        counter_last_track_change++;
-        if (track_change_intervals[focus_track] > 0 && counter_last_track_change/SEQT_NOTES_COLUMNS >= track_change_intervals[focus_track]) {
-            focus_track = next_tracks[focus_track];
-            counter_last_track_change = 0;
-        }
-        
-        last_note_evaluated = note_to_evaluate;
+void snapshot_lane(snapshot_io *io, lane_queue *q) {
+    uint16_t count = q->count;
+    snapshot_field(io, &count, sizeof(count));
+    if (io->load) {
+        if (count > LANE_QUEUE_SIZE) io->ok = false;
+        if (!io->ok) return;
+        lane_clear(q);
+        q->count = count;
     }
+    for (int k = 0; k < count; k++) {
+        lane_note *note = lane_at(q,k);
+        int32_t frame = note->frame;
+        int16_t y = note->y;
+        int32_t target = note->target;
+        snapshot_field(io, &frame, sizeof(frame));
+        snapshot_field(io, &y, sizeof(y));
+        snapshot_field(io, &target, sizeof(target));
+        note->frame = frame;
+        note->y = y;
+        note->target = target;
+    }
+}
 
-    // play music
-    seqt_poll_sound(sound);
+// loaded events are replayed as is, their lane indexes the lane queues
+bool chart_event_valid(game_state *game, chart_event *event) {
+    switch (event->type) {
+    case CHART_TICK: return event->lane < MAX_TICKS;
+    case CHART_ARROW: return event->lane < game->n_cols;
+    case CHART_SPEED_CHANGE:
+    case CHART_INTERVAL_CHANGE: return true;
+    default: return false;
+    }
+}
 
-    // update outcard
-    riv->outcard_len = riv_snprintf((char*)riv->outcard, RIV_SIZE_OUTCARD,
-        "JSON{\"frame\":%d,\"score\":%d,\"notes_interval\":%d,\"speed\":%.5f,\"max_combo\":%d,\"max_combo_score\":%d,\"n_perfect\":%d,\"n_nice\":%d,\"n_good\":%d,\"n_miss\":%d,\"n_bad\":%d,\"end_reason\":%d}",
-        riv->frame, score, notes_interval, new_tile_speed, max_combo, max_combo_score,n_perfects,n_nice,n_good,n_miss,n_bad,NOT_ENDED);
+// walk every field of the game progress, saving or loading it
+void snapshot_game_io(game_state *game, snapshot_io *io) {
+    uint8_t magic[MAGIC_SIZE] = {'R','S','N','P'};
+    uint8_t version = SNAPSHOT_VERSION;
+    uint64_t frame = riv->frame;
+    snapshot_field(io, magic, sizeof(magic));
+    snapshot_field(io, &version, sizeof(version));
+    snapshot_field(io, &frame, sizeof(frame));
+    if (io->load && (memcmp(magic, "RSNP", MAGIC_SIZE) || version != SNAPSHOT_VERSION || frame != riv->frame)) io->ok = false;
+    if (!io->ok) return;
+
+    // game flow
+    snapshot_field(io, &game->wait, sizeof(game->wait));
+    snapshot_field(io, &game->random_wait_frame, sizeof(game->random_wait_frame));
+    snapshot_field(io, &game->started, sizeof(game->started));
+    snapshot_field(io, &game->ended, sizeof(game->ended));
+    snapshot_field(io, &game->end_reason, sizeof(game->end_reason));
+    if (io->load && game->end_reason > MISSES_END) io->ok = false;
+    // sound handles are local to the instance, the song is activated on restore
+    int32_t chosen_song = game->chosen_song;
+    snapshot_field(io, &chosen_song, sizeof(chosen_song));
+    if (io->load && (chosen_song < -1 || chosen_song >= game->n_songs)) io->ok = false;
+    if (!io->ok) return;
+    game->chosen_song = chosen_song;
+
+    // speed and difficulty
+    snapshot_field(io, &game->tile_speed, sizeof(game->tile_speed));
+    snapshot_field(io, &game->new_tile_speed, sizeof(game->new_tile_speed));
+    snapshot_field(io, &game->frame_increase_speed, sizeof(game->frame_increase_speed));
+    snapshot_field(io, &game->frames_until_mark, sizeof(game->frames_until_mark));
+    snapshot_field(io, &game->latency, sizeof(game->latency));
+    snapshot_field(io, &game->notes_interval, sizeof(game->notes_interval));
+    snapshot_field(io, &game->focus_track, sizeof(game->focus_track));
+    if (io->load && game->focus_track >= SEQT_NOTES_TRACKS) io->ok = false;
+
+    // score
+    snapshot_field(io, &game->combo_moves, sizeof(game->combo_moves));
+    snapshot_field(io, &game->consecutive_misses, sizeof(game->consecutive_misses));
+    snapshot_field(io, &game->score, sizeof(game->score));
+    snapshot_field(io, &game->n_perfects, sizeof(game->n_perfects));
+    snapshot_field(io, &game->n_nice, sizeof(game->n_nice));
+    snapshot_field(io, &game->n_good, sizeof(game->n_good));
+    snapshot_field(io, &game->n_miss, sizeof(game->n_miss));
+    snapshot_field(io, &game->n_bad, sizeof(game->n_bad));
+    snapshot_field(io, &game->max_combo_score, sizeof(game->max_combo_score));
+    snapshot_field(io, &game->max_combo, sizeof(game->max_combo));
+    snapshot_field(io, &game->perfect_hit, sizeof(game->perfect_hit));
+    snapshot_field(io, &game->nice_hit, sizeof(game->nice_hit));
+    snapshot_field(io, &game->good_hit, sizeof(game->good_hit));
+
+    // chart compiler
+    snapshot_field(io, &game->chart_done, sizeof(game->chart_done));
+    snapshot_field(io, &game->chart_start_frame, sizeof(game->chart_start_frame));
+    snapshot_field(io, &game->chart_step, sizeof(game->chart_step));
+    snapshot_field(io, &game->chart_new_tile_speed, sizeof(game->chart_new_tile_speed));
+    snapshot_field(io, &game->chart_notes_interval, sizeof(game->chart_notes_interval));
+    if (io->load && (game->chart_notes_interval < 1 || game->chart_notes_interval > MAX_NOTE_INTERVAL)) io->ok = false;
+    snapshot_field(io, &game->frame_increase_speed_buffer, sizeof(game->frame_increase_speed_buffer));
+    snapshot_field(io, &game->last_note_evaluated, sizeof(game->last_note_evaluated));
+    snapshot_field(io, &game->counter_last_speed_change, sizeof(game->counter_last_speed_change));
+    snapshot_field(io, &game->counter_last_interval_change, sizeof(game->counter_last_interval_change));
+    snapshot_field(io, &game->counter_last_track_change, sizeof(game->counter_last_track_change));
+
+    // chart events not consumed yet
+    uint16_t n_events = game->chart_len - game->chart_cursor;
+    snapshot_field(io, &n_events, sizeof(n_events));
+    if (io->load) {
+        if (n_events > CHART_SIZE) io->ok = false;
+        if (!io->ok) return;
+        game->chart_cursor = 0;
+        game->chart_len = n_events;
+    }
+    for (int k = 0; k < n_events; k++) {
+        chart_event *event = &game->chart[game->chart_cursor + k];
+        snapshot_field(io, &event->frame, sizeof(event->frame));
+        snapshot_field(io, &event->target, sizeof(event->target));
+        snapshot_field(io, &event->type, sizeof(event->type));
+        snapshot_field(io, &event->lane, sizeof(event->lane));
+        snapshot_field(io, &event->row, sizeof(event->row));
+        if (io->load && !chart_event_valid(game, event)) io->ok = false;
+    }
+
+    // event log
+    event_log *log = &game->events;
+    snapshot_field(io, &log->size, sizeof(log->size));
+    snapshot_field(io, &log->n_events, sizeof(log->n_events));
+    snapshot_field(io, &log->n_dropped, sizeof(log->n_dropped));
+    snapshot_field(io, &log->start_frame, sizeof(log->start_frame));
+    snapshot_field(io, &log->last_frame, sizeof(log->last_frame));
+    if (io->load && log->size > EVENT_LOG_SIZE) io->ok = false;
+    if (!io->ok) return;
+    snapshot_field(io, log->data, log->size);
+
+    // lanes
+    for (int c = 0; c < game->n_cols; c++) {
+        snapshot_field(io, &game->pressed[c], sizeof(game->pressed[c]));
+        snapshot_field(io, &game->pressed_match[c], sizeof(game->pressed_match[c]));
+        snapshot_field(io, &game->animation_match[c], sizeof(game->animation_match[c]));
+        snapshot_field(io, &game->animation_frames[c], sizeof(game->animation_frames[c]));
+        snapshot_lane(io, &game->sliding_arrows[c]);
+    }
+    for (int t = 0; t < MAX_TICKS; t++) snapshot_lane(io, &game->sliding_ticks[t]);
+
+    // music position
+    seqt_sound *sound = io->load ? &io->sound : seqt_get_sound(&game->seqt, game->chosen_sound);
+    io->has_sound = sound != NULL;
+    snapshot_field(io, &io->has_sound, sizeof(io->has_sound));
+    if (io->load && io->has_sound && game->chosen_song < 0) io->ok = false;
+    if (!io->ok || !io->has_sound) return;
+    snapshot_field(io, &sound->frame, sizeof(sound->frame));
+    snapshot_field(io, &sound->start_frame, sizeof(sound->start_frame));
+    snapshot_field(io, &sound->stop_frame, sizeof(sound->stop_frame));
+    snapshot_field(io, &sound->last_note_frame, sizeof(sound->last_note_frame));
+    snapshot_field(io, &sound->paused, sizeof(sound->paused));
+}
+
+// Save the game progress into data, returns the snapshot size even when it doesn't fit.
+// The RIV random generator is not included, so take snapshots once the game has started.
+size_t snapshot_game(game_state *game, uint8_t *data, size_t size) {
+    snapshot_io io = {.data = data, .size = data ? size : 0, .ok = true};
+    snapshot_game_io(game, &io);
+    return io.len;
+}
+
+// Load a snapshot taken on this frame by an instance started with the same parameters and incard
+bool restore_game(game_state *game, const uint8_t *data, size_t size) {
+    // load into a copy so a malformed snapshot leaves the game untouched
+    game_state *restored = malloc(sizeof(game_state));
+    if (!restored) return false;
+    *restored = *game;
+    snapshot_io io = {.data = (uint8_t*)data, .size = size, .load = true, .ok = true};
+    snapshot_game_io(restored, &io);
+    int live_song = game->chosen_song;
+    if (io.ok) *game = *restored;
+    free(restored);
+    if (!io.ok) return false;
+
+    if (!io.has_sound) {
+        seqt_stop(&game->seqt, game->chosen_sound);
+        return true;
+    }
+    if (game->chosen_song != live_song || !seqt_get_sound(&game->seqt, game->chosen_sound)) activate_song(game, game->chosen_song);
+    seqt_sound *sound = seqt_get_sound(&game->seqt, game->chosen_sound);
+    if (!sound) return false;
+    game->chart_clock = seqt_make_clock(sound->source->bpm, sound->speed, riv->target_fps);
+    sound->frame = io.sound.frame;
+    sound->start_frame = io.sound.start_frame;
+    sound->stop_frame = io.sound.stop_frame;
+    sound->last_note_frame = io.sound.last_note_frame;
+    seqt_set_paused(&game->seqt, game->chosen_sound, io.sound.paused);
+    return true;
+}
+
+#ifndef HEADLESS
+// Get a HUD text, formatting it again only when its value changed
+const char *hud_text(game_state *game, int field, int64_t value) {
+    hud_cache *cache = &game->hud;
+    char *text = cache->texts[field];
+    if (cache->valid[field] && cache->values[field] == value) return text;
+    cache->valid[field] = true;
+    cache->values[field] = value;
+    switch (field) {
+    case HUD_COMBO:
+        riv_snprintf(text, HUD_TEXT_SIZE, "COMBO: %d", (int)value);
+        break;
+    case HUD_MISSES:
+        riv_snprintf(text, HUD_TEXT_SIZE, "bad/miss: %d", (int)value);
+        break;
+    case HUD_SPEED: // value holds the float bits
+        riv_snprintf(text, HUD_TEXT_SIZE, "Speed: %.2f\n", game->new_tile_speed);
+        break;
+    case HUD_DIFFICULTY:
+        riv_snprintf(text, HUD_TEXT_SIZE, "Diff.: %d", (int)value);
+        break;
+    case HUD_SCORE:
+        riv_snprintf(text, HUD_TEXT_SIZE, "Score: %d", (int)value);
+        break;
+    case HUD_SONG_HASH:
+        riv_snprintf(text, HUD_TEXT_SIZE, "%08x", (uint32_t)value);
+        break;
+    case HUD_SONG:
+        riv_snprintf(text, HUD_TEXT_SIZE, "Sound to play: %d/%d", (int)value + 1, game->n_songs);
+        break;
+    case HUD_LATENCY:
+        riv_snprintf(text, HUD_TEXT_SIZE, "Latency: %+.2f frames", (double)value / LATENCY_ONE);
+        break;
+    }
+    return text;
 }
 
 // Draw the game canvas
-void draw_game() {
-    riv_clear(perfect_hit || nice_hit ? RIV_COLOR_SLATE : RIV_COLOR_DARKSLATE);
+void draw_game(game_state *game) {
+    riv_clear(game->perfect_hit || game->nice_hit ? RIV_COLOR_SLATE : RIV_COLOR_DARKSLATE);
 
-    // draw tick markings
+    // draw tick markings, as one pixel high fills which are cheaper than lines
     for (int t = 0; t < MAX_TICKS; t++) {
-        for (int i = 0; i < SCREEN_SIZE - TILE_SIZE/2; i++) {
-            if (sliding_ticks[t][i]) {
-                riv_draw_line(0,i+TILE_SIZE/2,SCREEN_SIZE-1,i+TILE_SIZE/2,tick_colors[t]);
+        for (int k = 0; k < game->sliding_ticks[t].count; k++) {
+            int i = lane_at(&game->sliding_ticks[t],k)->y;
+            if (i < SCREEN_SIZE - TILE_SIZE/2) {
+                riv_draw_rect_fill(0,i+TILE_SIZE/2,SCREEN_SIZE,1,tick_colors[t]);
             }
         }
     }
@@ -557,127 +1682,129 @@ void draw_game() {
     // perfect hit animation
     int dx = 0;
     int dy = 0;
-    if (perfect_hit) {
+    if (game->perfect_hit) {
         dx = riv_rand_int(-1,1);
         dy = riv_rand_int(-1,1);
     }
 
-    for (int c = 0; c < n_cols; c++) {
+    // receptors, the pressed ones recolored in one palette switch
+    for (int c = 0; c < game->n_cols; c++) {
+        if (!game->pressed[c]) riv_draw_sprite(col_sprite_ids[c], spritesheet_controls, game->x_cols[c] + dx, TOP_Y + dy, 1, 1, 1, 1);
+    }
+    riv->draw.pal_enabled = true;
+    riv->draw.pal[RIV_COLOR_BLACK] = RIV_COLOR_RED;
+    riv->draw.pal[RIV_COLOR_WHITE] = RIV_COLOR_LIGHTPEACH;
+    for (int c = 0; c < game->n_cols; c++) {
+        if (game->pressed[c]) riv_draw_sprite(col_sprite_ids[c], spritesheet_controls, game->x_cols[c] + dx, TOP_Y + dy, 1, 1, 1, 1);
+    }
+    riv->draw.pal[RIV_COLOR_BLACK] = RIV_COLOR_BLACK;
+    riv->draw.pal[RIV_COLOR_WHITE] = RIV_COLOR_WHITE;
+    riv->draw.pal_enabled = false;
+
+    for (int c = 0; c < game->n_cols; c++) {
         // draw press resul
 
         // draw press result
-        switch (animation_match[c]) {
+        switch (game->animation_match[c]) {
         case STATE_PERFECT:
-            riv_draw_text("PERFECT!", RIV_SPRITESHEET_FONT_5X7, RIV_BOTTOMLEFT, x_cols[c] + riv_rand_int(-1,1) + dx, TOP_Y - 2 + riv_rand_int(-1,1) + dy, 1, (animation_frames[c] / 6) % 2 ? RIV_COLOR_GOLD : RIV_COLOR_ORANGE);
+            riv_draw_text("PERFECT!", RIV_SPRITESHEET_FONT_5X7, RIV_BOTTOMLEFT, game->x_cols[c] + riv_rand_int(-1,1) + dx, TOP_Y - 2 + riv_rand_int(-1,1) + dy, 1, (game->animation_frames[c] / 6) % 2 ? RIV_COLOR_GOLD : RIV_COLOR_ORANGE);
             break;
         case STATE_NICE:
-            riv_draw_text("Nice!", RIV_SPRITESHEET_FONT_5X7, RIV_BOTTOMLEFT, x_cols[c] + dx, TOP_Y - 2 + dy, 1, (animation_frames[c] / 10) % 2 ? RIV_COLOR_GREEN : RIV_COLOR_LIGHTGREEN);
+            riv_draw_text("Nice!", RIV_SPRITESHEET_FONT_5X7, RIV_BOTTOMLEFT, game->x_cols[c] + dx, TOP_Y - 2 + dy, 1, (game->animation_frames[c] / 10) % 2 ? RIV_COLOR_GREEN : RIV_COLOR_LIGHTGREEN);
             break;
         case STATE_GOOD:
-            riv_draw_text("Good", RIV_SPRITESHEET_FONT_5X7, RIV_BOTTOMLEFT, x_cols[c] + dx, TOP_Y - 2 + dy, 1, (animation_frames[c] / 12) % 2 ? RIV_COLOR_LIGHTBLUE : RIV_COLOR_LIGHTBLUE);
+            riv_draw_text("Good", RIV_SPRITESHEET_FONT_5X7, RIV_BOTTOMLEFT, game->x_cols[c] + dx, TOP_Y - 2 + dy, 1, (game->animation_frames[c] / 12) % 2 ? RIV_COLOR_LIGHTBLUE : RIV_COLOR_LIGHTBLUE);
             break;
         case STATE_BAD:
-            riv_draw_text("Bad", RIV_SPRITESHEET_FONT_5X7, RIV_BOTTOMLEFT, x_cols[c] + dx, TOP_Y - 2 + dy, 1, (animation_frames[c] / 15) % 2 ? RIV_COLOR_LIGHTRED : RIV_COLOR_RED);
+            riv_draw_text("Bad", RIV_SPRITESHEET_FONT_5X7, RIV_BOTTOMLEFT, game->x_cols[c] + dx, TOP_Y - 2 + dy, 1, (game->animation_frames[c] / 15) % 2 ? RIV_COLOR_LIGHTRED : RIV_COLOR_RED);
             break;
         case STATE_MISS:
-            riv_draw_text("Miss", RIV_SPRITESHEET_FONT_5X7, RIV_BOTTOMLEFT, x_cols[c] + dx, TOP_Y - 2 + dy, 1, (animation_frames[c] / 15) % 2 ? RIV_COLOR_LIGHTGREY : RIV_COLOR_GREY);
+            riv_draw_text("Miss", RIV_SPRITESHEET_FONT_5X7, RIV_BOTTOMLEFT, game->x_cols[c] + dx, TOP_Y - 2 + dy, 1, (game->animation_frames[c] / 15) % 2 ? RIV_COLOR_LIGHTGREY : RIV_COLOR_GREY);
             break;
         default:
             break;
         }
 
-        // draw press animation
-        if (pressed[c]) {
-
-            riv->draw.pal_enabled = true;
-            riv->draw.pal[RIV_COLOR_BLACK] = RIV_COLOR_RED; // red
-            riv->draw.pal[RIV_COLOR_WHITE] = RIV_COLOR_LIGHTPEACH;
-            riv_draw_sprite(col_sprite_ids[c], spritesheet_controls, x_cols[c] + dx, TOP_Y + dy, 1, 1, 1, 1);
-            riv->draw.pal[RIV_COLOR_BLACK] = RIV_COLOR_BLACK;
-            riv->draw.pal[RIV_COLOR_WHITE] = RIV_COLOR_WHITE;
-            riv->draw.pal_enabled = false;
-        } else riv_draw_sprite(col_sprite_ids[c], spritesheet_controls, x_cols[c] + dx, TOP_Y + dy, 1, 1, 1, 1);
-        
-
-        for (int i=0; i<SCREEN_SIZE; i++) {
-            if (sliding_arrows[c][i]) riv_draw_sprite(col_sprite_ids[c], spritesheet_controls, x_cols[c] + dx, i, 1, 1, 1, 1);
+        int sprite_id = col_sprite_ids[c];
+        int x = game->x_cols[c] + dx;
+        lane_queue *lane = &game->sliding_arrows[c];
+        for (int k = 0; k < lane->count; k++) {
+            riv_draw_sprite(sprite_id, spritesheet_controls, x, lane_at(lane,k)->y, 1, 1, 1, 1);
         }
     }
     
     // draw score and combo
-    char buf[128];
-    if (show_stats) {
-        riv_snprintf(buf, sizeof(buf), "COMBO: %d",combo_moves);
-        riv_draw_text(buf, RIV_SPRITESHEET_FONT_5X7, RIV_TOPRIGHT, 246, 240, 1, RIV_COLOR_WHITE);
-        riv_snprintf(buf, sizeof(buf), "bad/miss: %d",n_bad+n_miss);
-        riv_draw_text(buf, RIV_SPRITESHEET_FONT_5X7, RIV_TOPRIGHT, 246, 220, 1, RIV_COLOR_WHITE);
-        riv_snprintf(buf, sizeof(buf), "Speed: %.2f\n",new_tile_speed);
-        riv_draw_text(buf, RIV_SPRITESHEET_FONT_5X7, RIV_TOPLEFT, 10, 220, 1, RIV_COLOR_WHITE);
-        riv_snprintf(buf, sizeof(buf), "Diff.: %d",1+MAX_NOTE_INTERVAL-notes_interval);
-        riv_draw_text(buf, RIV_SPRITESHEET_FONT_5X7, RIV_TOPLEFT, 10, 240, 1, RIV_COLOR_WHITE);
-        riv_snprintf(buf, sizeof(buf), "Score: %d",score);
-        riv_draw_text(buf, RIV_SPRITESHEET_FONT_5X7, RIV_TOP, 128, 220, 1, RIV_COLOR_WHITE);
-        riv_snprintf(buf, sizeof(buf), "%08x",sound_hashes[chosen_sound_ind]);
-        riv_draw_text(buf, RIV_SPRITESHEET_FONT_5X7, RIV_TOP, 128, 240, 1, RIV_COLOR_WHITE);
+    if (game->show_stats) {
+        uint32_t speed_bits;
+        memcpy(&speed_bits, &game->new_tile_speed, sizeof(speed_bits));
+        riv_draw_text(hud_text(game, HUD_COMBO, game->combo_moves), RIV_SPRITESHEET_FONT_5X7, RIV_TOPRIGHT, 246, 240, 1, RIV_COLOR_WHITE);
+        riv_draw_text(hud_text(game, HUD_MISSES, game->n_bad+game->n_miss), RIV_SPRITESHEET_FONT_5X7, RIV_TOPRIGHT, 246, 220, 1, RIV_COLOR_WHITE);
+        riv_draw_text(hud_text(game, HUD_SPEED, speed_bits), RIV_SPRITESHEET_FONT_5X7, RIV_TOPLEFT, 10, 220, 1, RIV_COLOR_WHITE);
+        riv_draw_text(hud_text(game, HUD_DIFFICULTY, 1+MAX_NOTE_INTERVAL-game->notes_interval), RIV_SPRITESHEET_FONT_5X7, RIV_TOPLEFT, 10, 240, 1, RIV_COLOR_WHITE);
+        riv_draw_text(hud_text(game, HUD_SCORE, game->score), RIV_SPRITESHEET_FONT_5X7, RIV_TOP, 128, 220, 1, RIV_COLOR_WHITE);
+        riv_draw_text(hud_text(game, HUD_SONG_HASH, game->songs[game->chosen_song].hash), RIV_SPRITESHEET_FONT_5X7, RIV_TOP, 128, 240, 1, RIV_COLOR_WHITE);
     }
-    riv_snprintf(buf, sizeof(buf), "%s",version);
-    riv_draw_text(buf, RIV_SPRITESHEET_FONT_5X7, RIV_BOTTOMRIGHT, 255, 255, 1, RIV_COLOR_SLATE);
+    riv_draw_text(version, RIV_SPRITESHEET_FONT_5X7, RIV_BOTTOMRIGHT, 255, 255, 1, RIV_COLOR_SLATE);
 
 }
+#endif
 
-void update_start_screen() {
+void update_start_screen(game_state *game) {
 
     // song selection
     if (riv->frame > 0) {
-        if (n_sounds > 0) {
-            if (chosen_sound_ind < 0) {
-                chosen_sound_ind = 0;
-                chosen_sound = sound_ids[chosen_sound_ind];
+        if (game->n_songs > 0) {
+            if (game->chosen_song < 0) {
+                activate_song(game, 0);
             }
-            // seqt_sound *sound = &seqt.sounds[chosen_sound];
             if (riv->keys[RIV_GAMEPAD1_RIGHT].press || riv->keys[RIV_GAMEPAD1_LEFT].press ||
                     riv->keys[RIV_GAMEPAD1_UP].press || riv->keys[RIV_GAMEPAD1_DOWN].press) {
+                int song = game->chosen_song;
                 if (riv->keys[RIV_GAMEPAD1_RIGHT].press || riv->keys[RIV_GAMEPAD1_DOWN].press) {
-                    chosen_sound_ind = chosen_sound_ind == n_sounds - 1 ? 0 : chosen_sound_ind + 1;
+                    song = song == game->n_songs - 1 ? 0 : song + 1;
                 } else if (riv->keys[RIV_GAMEPAD1_LEFT].press || riv->keys[RIV_GAMEPAD1_UP].press) {
-                    chosen_sound_ind = chosen_sound_ind == 0 ? n_sounds - 1 : chosen_sound_ind - 1;
+                    song = song == 0 ? game->n_songs - 1 : song - 1;
                 }
-                chosen_sound = sound_ids[chosen_sound_ind];
-                seqt_set_start(chosen_sound,0.2);
-                seqt_seek(chosen_sound,0.0);
+                if (song != game->chosen_song) activate_song(game, song);
+                seqt_set_start(&game->seqt, game->chosen_sound,0.2);
+                seqt_seek(&game->seqt, game->chosen_sound,0.0);
             }
-            seqt_poll_sound(seqt_get_sound(chosen_sound));
+            PROFILE_BEGIN(PROFILE_MUSIC);
+            seqt_poll_sound(seqt_get_sound(&game->seqt, game->chosen_sound));
+            PROFILE_END(game, PROFILE_MUSIC);
         }
     }
 
+#ifndef HEADLESS
     // floating arrow animation
     float speed = (1.0 * TILE_SIZE) / 40;
     // add some
-    for (int c = 0; c < n_cols; c++) {
-        for (int i=0; i < SCREEN_SIZE; i++) {
-            if (sliding_arrows[c][i]) {
-                int next_i = (int)round(SCREEN_SIZE - 1 - speed * (riv->frame - sliding_arrows[c][i]));
-                if (next_i >= 0) sliding_arrows[c][next_i] = sliding_arrows[c][i];
-                else sliding_arrows[c][SCREEN_SIZE - 1] = riv->frame;
-                if (i != next_i) sliding_arrows[c][i] = 0;
-            }
+    for (int c = 0; c < game->n_cols; c++) {
+        lane_queue *lane = &game->sliding_arrows[c];
+        int n = 0;
+        for (int k = 0; k < lane->count; k++) {
+            lane_note note = *lane_at(lane,k);
+            note.y = (int)round(SCREEN_SIZE - 1 - speed * (riv->frame - note.frame));
+            if (note.y < 0) note = (lane_note){.frame = riv->frame, .y = SCREEN_SIZE - 1, .target = riv->frame};
+            lane_place(lane, &n, note);
         }
+        lane->count = n;
     }
+#endif
 }
 
+#ifndef HEADLESS
 // Draw game start screen
-void draw_start_screen() {
+void draw_start_screen(game_state *game) {
 
     // Draw title bg
     riv_clear(RIV_COLOR_DARKSLATE);
 
 
     // draw animation
-    for (int c = 0; c < n_cols; c++) {
-        for (int i=0; i<SCREEN_SIZE; i++) {
-            if (sliding_arrows[c][i]) {
-                riv_draw_sprite(col_sprite_ids[c], spritesheet_controls, x_cols[c], i, 1, 1, 1, 1);
-            }
+    for (int c = 0; c < game->n_cols; c++) {
+        for (int k = 0; k < game->sliding_arrows[c].count; k++) {
+            riv_draw_sprite(col_sprite_ids[c], spritesheet_controls, game->x_cols[c], lane_at(&game->sliding_arrows[c],k)->y, 1, 1, 1, 1);
         }
     }
 
@@ -691,131 +1818,224 @@ void draw_start_screen() {
     if (riv->frame)
         riv_draw_text("PRESS A1/Z TO START", RIV_SPRITESHEET_FONT_3X5, RIV_CENTER, 128, 128+32, 2, col);
 
-    if (chosen_sound) {
-        char buf[128];
-        riv_snprintf(buf, sizeof(buf), "Sound to play: %d/%d",chosen_sound,n_sounds);
-        riv_draw_text(buf, RIV_SPRITESHEET_FONT_5X7, RIV_TOP, 128, 128+64, 1, RIV_COLOR_WHITE);
-        riv_snprintf(buf, sizeof(buf), "%08x",sound_hashes[chosen_sound_ind]);
-        riv_draw_text(buf, RIV_SPRITESHEET_FONT_5X7, RIV_TOP, 128, 128+84, 1, RIV_COLOR_WHITE);
-        riv_snprintf(buf, sizeof(buf), "%s",version);
-        riv_draw_text(buf, RIV_SPRITESHEET_FONT_5X7, RIV_BOTTOMRIGHT, 255, 255, 1, RIV_COLOR_SLATE);
+    if (game->chosen_sound) {
+        riv_draw_text(hud_text(game, HUD_SONG, game->chosen_song), RIV_SPRITESHEET_FONT_5X7, RIV_TOP, 128, 128+64, 1, RIV_COLOR_WHITE);
+        riv_draw_text(hud_text(game, HUD_SONG_HASH, game->songs[game->chosen_song].hash), RIV_SPRITESHEET_FONT_5X7, RIV_TOP, 128, 128+84, 1, RIV_COLOR_WHITE);
+        riv_draw_text(hud_text(game, HUD_LATENCY, game->latency), RIV_SPRITESHEET_FONT_5X7, RIV_TOP, 128, 128+104, 1, RIV_COLOR_LIGHTGREY);
+        riv_draw_text("A3 TO CALIBRATE", RIV_SPRITESHEET_FONT_3X5, RIV_BOTTOMLEFT, 1, 255, 1, RIV_COLOR_SLATE);
+        riv_draw_text(version, RIV_SPRITESHEET_FONT_5X7, RIV_BOTTOMRIGHT, 255, 255, 1, RIV_COLOR_SLATE);
     }
 }
 
+// Draw latency calibration screen, nothing moves with the clicks so only the sound is followed
+void draw_calibration_screen(game_state *game) {
+    riv_clear(RIV_COLOR_DARKSLATE);
+    riv_draw_text("CALIBRATION", RIV_SPRITESHEET_FONT_3X5, RIV_CENTER, 128, 96, 3, RIV_COLOR_PINK);
+    riv_draw_text("HIT ANY ARROW ON THE CLICKS", RIV_SPRITESHEET_FONT_3X5, RIV_CENTER, 128, 128, 1, RIV_COLOR_WHITE);
+    char buf[32];
+    riv_snprintf(buf, sizeof(buf), "%d/%d", game->n_calibration_offsets, CALIBRATION_PRESSES);
+    riv_draw_text(buf, RIV_SPRITESHEET_FONT_5X7, RIV_CENTER, 128, 148, 1, RIV_COLOR_WHITE);
+    riv_draw_text("SELECT TO CANCEL", RIV_SPRITESHEET_FONT_3X5, RIV_CENTER, 128, 200, 1, RIV_COLOR_SLATE);
+}
+
+#ifdef PROFILE
+// Draw min/avg/max of the last window for each scope, in thousands of cycles
+void draw_profile_overlay(game_state *game) {
+    riv_draw_rect_fill(0, 0, 112, 6*(N_PROFILE_SCOPES + 1) + 1, RIV_COLOR_BLACK);
+    riv_draw_text("scope    min/avg/max k", RIV_SPRITESHEET_FONT_3X5, RIV_TOPLEFT, 1, 1, 1, RIV_COLOR_LIGHTGREY);
+    char buf[64];
+    for (int s = 0; s < N_PROFILE_SCOPES; s++) {
+        profile_stats *stats = &game->profile.shown[s];
+        uint64_t avg = stats->n > 0 ? stats->sum / stats->n : 0;
+        riv_snprintf(buf, sizeof(buf), "%s %d/%d/%d", profile_names[s],
+            (int)(stats->min/1000), (int)(avg/1000), (int)(stats->max/1000));
+        riv_draw_text(buf, RIV_SPRITESHEET_FONT_3X5, RIV_TOPLEFT, 1, 7 + 6*s, 1, RIV_COLOR_WHITE);
+    }
+}
+#endif
+
 // Draw game over screen
-void draw_end_screen() {
+void draw_end_screen(game_state *game) {
     // Draw last game frame
-    draw_game();
+    draw_game(game);
     // Draw GAME OVER
     char buf[128];
-    if (end_reason == FORCED_END) {
+    if (game->end_reason == FORCED_END) {
         riv_snprintf(buf, sizeof(buf), "Gave up!");
-    } else if (end_reason == MUSIC_END) {
+    } else if (game->end_reason == MUSIC_END) {
         riv_snprintf(buf, sizeof(buf), "Done!");
-    } else if (end_reason == MISSES_END) {
+    } else if (game->end_reason == MISSES_END) {
         riv_snprintf(buf, sizeof(buf), "Too Bad!");
     } else {
         riv_snprintf(buf, sizeof(buf), "GAME OVER");
     }
     riv_draw_text(buf, RIV_SPRITESHEET_FONT_3X5, RIV_CENTER, 128, 128, 4, RIV_COLOR_LIGHTRED);
 }
+#endif
 
 // Called every frame to update game state
-void update() {
-    if (!wait) { // Game not started yet
+void update(game_state *game) {
+#ifdef PROFILE
+    if (game->stress) mash_all_keys();
+    if (riv->keys[RIV_GAMEPAD1_START].press) game->profile.overlay = !game->profile.overlay;
+#endif
+    if (game->calibrating) { // Latency calibration, lane keys are taken by it
+        update_calibration(game);
+    } else if (!game->wait) { // Game not started yet
         // Let game start whenever a key has been pressed
-        if ((riv->keys[RIV_GAMEPAD1_A1].press || riv->keys[RIV_GAMEPAD1_A2].press) && chosen_sound) {
-            random_wait();
+        if ((riv->keys[RIV_GAMEPAD1_A1].press || riv->keys[RIV_GAMEPAD1_A2].press) && game->chosen_sound) {
+            random_wait(game);
+            return;
+        }
+        if (riv->keys[RIV_GAMEPAD1_A3].press && game->chosen_sound) {
+            start_calibration(game);
             return;
         }
 
-        update_start_screen();
-    } else if (!started) { // waiting
-        if (riv->frame > random_wait_frame) {
-            start_game();
+        update_start_screen(game);
+    } else if (!game->started) { // waiting
+        if ((int)riv->frame > game->random_wait_frame) {
+            start_game(game);
         }
-    } else if (!ended) { // Game is progressing
-        update_game();
+    } else if (!game->ended) { // Game is progressing
+        update_game(game);
     }
 }
 
+#ifndef HEADLESS
 // Called every frame to draw the game
-void draw() {
-    // Clear screen
-    riv_clear(RIV_COLOR_DARKSLATE);
+void draw(game_state *game) {
+    PROFILE_BEGIN(PROFILE_DRAW);
+    // Each screen clears the frame once itself
     // Draw different screens depending on the game state
-    if (!started) { // Game not started yet
-        draw_start_screen();
-    } else if (!ended) { // Game is progressing
-        draw_game();
+    if (game->calibrating) { // Latency calibration
+        draw_calibration_screen(game);
+    } else if (!game->started) { // Game not started yet
+        draw_start_screen(game);
+    } else if (!game->ended) { // Game is progressing
+        draw_game(game);
     } else { // Game ended
-        draw_end_screen();
+        draw_end_screen(game);
     }
+    PROFILE_END(game, PROFILE_DRAW);
+#ifdef PROFILE
+    if (game->profile.overlay) draw_profile_overlay(game);
+#endif
 }
+#endif
 
-// Entry point
-int main(int argc, char* argv[]) {
-    if (argc > 1) {
-        if (argc % 2 == 0) {
-            riv_printf("Wrong number of arguments\n");
-            return 1;
-        }
+// Read the cartridge arguments into the game parameters, false when they are malformed
+bool parse_arguments(game_state *game, int argc, char* argv[]) {
+    if (argc > 1 && argc % 2 == 0) {
+        riv_printf("Wrong number of arguments\n");
+        return false;
+    }
 
-        for (int i = 1; i < argc; i+=2) {
-            if (strcmp(argv[i], "-n-cols") == 0) {
-                n_cols = clampu(atoi(argv[i+1]),1,MAX_COLS);
-            } else if (strcmp(argv[i], "-speed") == 0) {
-                new_tile_speed = strtof(argv[i+1], NULL);
-            } else if (strcmp(argv[i], "-speed-modifier") == 0) {
-                tile_speed_modifier = strtof(argv[i+1], NULL);
-            } else if (strcmp(argv[i], "-speed-increase-interval") == 0) {
-                speed_increase_interval = atoi(argv[i+1]);
-            } else if (strcmp(argv[i], "-notes-interval") == 0) {
-                notes_interval = clampu(atoi(argv[i+1]),1,MAX_NOTE_INTERVAL);
-            } else if (strcmp(argv[i], "-notes-increase-interval") == 0) {
-                notes_increase_interval = atoi(argv[i+1]);
-            } else if (strcmp(argv[i], "-track-change-intervals") == 0) {
-                char *delim = ","; 
-                char *token = strtok(argv[i+1], delim);
-                for (int t = 0; token != NULL && t < SEQT_NOTES_TRACKS; t++) {
-                    track_change_intervals[t] = atoi(token);
-                    token = strtok(NULL, delim); 
-                }
-            } else if (strcmp(argv[i], "-next-tracks") == 0) {
-                char *delim = ","; 
-                char *token = strtok(argv[i+1], delim);
-                for (int t = 0; token != NULL && t < SEQT_NOTES_TRACKS; t++) {
-                    next_tracks[t] = atoi(token);
-                    token = strtok(NULL, delim); 
-                }
-            } else if (strcmp(argv[i], "-track") == 0) {
-                focus_track = clampu(atoi(argv[i+1]),0,SEQT_NOTES_TRACKS-1);
-            } else if (strcmp(argv[i], "-good-multiplier") == 0) {
-                good_multiplier = strtof(argv[i+1], NULL);
-            } else if (strcmp(argv[i], "-perfect-multiplier") == 0) {
-                perfect_multiplier = strtof(argv[i+1], NULL);
-            } else if (strcmp(argv[i], "-show-stats") == 0) {
-                show_stats = atoi(argv[i+1]);
-            } else if (strcmp(argv[i], "-max-misses") == 0) {
-                max_misses = atoi(argv[i+1]);
-            } else if (strcmp(argv[i], "-n-loops") == 0) {
-                n_loops = atoi(argv[i+1]);
-            } else if (strcmp(argv[i], "-fix-frame") == 0) {
-                fix_frame = atoi(argv[i+1]);
+    for (int i = 1; i < argc; i+=2) {
+        if (strcmp(argv[i], "-n-cols") == 0) {
+            game->n_cols = clampu(atoi(argv[i+1]),1,MAX_COLS);
+        } else if (strcmp(argv[i], "-speed") == 0) {
+            game->new_tile_speed = bound_speed(strtof(argv[i+1], NULL));
+        } else if (strcmp(argv[i], "-speed-modifier") == 0) {
+            game->tile_speed_modifier = strtof(argv[i+1], NULL);
+        } else if (strcmp(argv[i], "-speed-increase-interval") == 0) {
+            game->speed_increase_interval = atoi(argv[i+1]);
+        } else if (strcmp(argv[i], "-notes-interval") == 0) {
+            game->notes_interval = clampu(atoi(argv[i+1]),1,MAX_NOTE_INTERVAL);
+        } else if (strcmp(argv[i], "-notes-increase-interval") == 0) {
+            game->notes_increase_interval = atoi(argv[i+1]);
+        } else if (strcmp(argv[i], "-track-change-intervals") == 0) {
+            char *delim = ",", *rest;
+            char *token = strtok_r(argv[i+1], delim, &rest);
+            for (int t = 0; token != NULL && t < SEQT_NOTES_TRACKS; t++) {
+                game->track_change_intervals[t] = atoi(token);
+                token = strtok_r(NULL, delim, &rest);
+            }
+        } else if (strcmp(argv[i], "-next-tracks") == 0) {
+            char *delim = ",", *rest;
+            char *token = strtok_r(argv[i+1], delim, &rest);
+            for (int t = 0; token != NULL && t < SEQT_NOTES_TRACKS; t++) {
+                game->next_tracks[t] = atoi(token);
+                token = strtok_r(NULL, delim, &rest);
             }
+        } else if (strcmp(argv[i], "-track") == 0) {
+            game->focus_track = clampu(atoi(argv[i+1]),0,SEQT_NOTES_TRACKS-1);
+        } else if (strcmp(argv[i], "-good-multiplier") == 0) {
+            game->good_multiplier = strtof(argv[i+1], NULL);
+        } else if (strcmp(argv[i], "-perfect-multiplier") == 0) {
+            game->perfect_multiplier = strtof(argv[i+1], NULL);
+        } else if (strcmp(argv[i], "-perfect-window") == 0) {
+            game->perfect_window = clampu(atoi(argv[i+1]),1,MAX_HIT_WINDOW);
+        } else if (strcmp(argv[i], "-nice-window") == 0) {
+            game->nice_window = clampu(atoi(argv[i+1]),1,MAX_HIT_WINDOW);
+        } else if (strcmp(argv[i], "-good-window") == 0) {
+            game->good_window = clampu(atoi(argv[i+1]),1,MAX_HIT_WINDOW);
+        } else if (strcmp(argv[i], "-show-stats") == 0) {
+            game->show_stats = atoi(argv[i+1]);
+        } else if (strcmp(argv[i], "-max-misses") == 0) {
+            game->max_misses = atoi(argv[i+1]);
+        } else if (strcmp(argv[i], "-n-loops") == 0) {
+            game->n_loops = atoi(argv[i+1]);
+        } else if (strcmp(argv[i], "-fix-frame") == 0) {
+            game->fix_frame = atoi(argv[i+1]);
+        } else if (strcmp(argv[i], "-latency") == 0) {
+            game->latency = clamp_latency(atoi(argv[i+1]));
+        } else if (strcmp(argv[i], "-binary-outcard") == 0) {
+            game->binary_outcard = atoi(argv[i+1]);
+#ifdef PROFILE
+        } else if (strcmp(argv[i], "-stress") == 0) {
+            game->stress = atoi(argv[i+1]);
+#endif
         }
     }
+    // the windows nest, whatever order they were given in
+    game->nice_window = minu(game->nice_window, game->good_window);
+    game->perfect_window = minu(game->perfect_window, game->nice_window);
+    return true;
+}
 
-    spritesheet_controls = riv_make_spritesheet(riv_make_image("controls.png", 0xff), TILE_SIZE, TILE_SIZE);
-
-    initialize();
-
-    // Main loop, keep presenting frames until user quit or game ends
+// Main loop, keep presenting frames until user quit or game ends
+void run(game_state *game) {
     do {
         // Update game state
-        update();
+        PROFILE_BEGIN(PROFILE_UPDATE);
+        update(game);
+        PROFILE_END(game, PROFILE_UPDATE);
+#ifndef HEADLESS
         // Draw game graphics
-        draw();
+        draw(game);
+#endif
+#ifdef PROFILE
+        profile_end_frame(game);
+#endif
     } while(riv_present());
+}
+
+// Stop the sounds and free the songs of a finished game, for hosts that run
+// many games in one process (the cartridge itself just exits)
+void release_game(game_state *game) {
+    seqt_quit(&game->seqt);
+    for (int i = 0; i < game->n_songs; i++) {
+        if (game->songs[i].mapped) seqt_destroy_source(game->songs[i].source);
+    }
+#ifdef PROFILE
+    if (game->stress && game->n_songs > 0) free(game->songs[0].source);
+#endif
+    free(game->calibration_source);
+    game->n_songs = 0;
+    game->calibration_source = NULL;
+}
+
+// Entry point
+int main(int argc, char* argv[]) {
+    init_game_state(&game);
+    if (!parse_arguments(&game, argc, argv)) return 1;
+
+#ifndef HEADLESS
+    spritesheet_controls = riv_make_spritesheet(riv_make_image("controls.png", 0xff), TILE_SIZE, TILE_SIZE);
+#endif
+
+    initialize(&game);
+    run(&game);
     return 0;
 }
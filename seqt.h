@@ -22,7 +22,13 @@ enum {
   SEQT_NOTES_ROWS = 10,
   SEQT_NOTES_SCALE_NOTES = 2*SEQT_NOTES_ROWS,
   SEQT_NOTES_TOTAL_COLUMNS = SEQT_NOTES_PAGES*SEQT_NOTES_COLUMNS,
+  SEQT_COLUMN_MASK_WORDS = (SEQT_NOTES_TOTAL_COLUMNS + 63)/64,
   SEQT_MAX_SOUNDS = 32,
+  // sound ids hold the slot in the low bits and the slot generation in the high bits,
+  // slot 0 is never used so id 0 is always invalid
+  SEQT_SOUND_SLOT_BITS = 32,
+  // fixed point scale of the clock speed
+  SEQT_CLOCK_SPEED_ONE = 1 << 16,
 };
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -43,6 +49,12 @@ typedef struct seqt_source {
   seqt_note pages[SEQT_NOTES_TRACKS][SEQT_NOTES_ROWS][SEQT_NOTES_TOTAL_COLUMNS];
 } seqt_source;
 
+typedef struct seqt_source_index {
+  uint16_t row_masks[SEQT_NOTES_TRACKS][SEQT_NOTES_TOTAL_COLUMNS]; // bit y is set when row y has a note
+  uint16_t track_notes[SEQT_NOTES_TRACKS]; // number of notes of each track
+  uint64_t column_masks[SEQT_NOTES_TRACKS][SEQT_COLUMN_MASK_WORDS]; // bit x%64 of word x/64 is set when column x has notes
+} seqt_source_index;
+
 typedef struct seqt_synth {
   riv_waveform_desc waves[SEQT_SYNTH_WAVES];
 } seqt_synth;
@@ -61,8 +73,20 @@ typedef struct seqt_synthnote {
   float bps;
 } seqt_synthnote;
 
+// Note step clock, steps per frame are the exact ratio bpm*SEQT_TIME_SIG*speed / (60*fps)
+typedef struct seqt_clock {
+  uint64_t steps; // ratio numerator
+  uint64_t frames; // ratio denominator
+  uint64_t frame; // elapsed frames
+  uint64_t step; // step at the elapsed frames
+  uint64_t remainder; // frame*steps - step*frames
+} seqt_clock;
+
+typedef struct seqt_context seqt_context;
+
 typedef struct seqt_sound {
   uint64_t id;
+  seqt_context *ctx; // owning context, its slot tables are updated when the sound stops or pauses
   seqt_soundfont *font;
   seqt_source *source;
   uint64_t frame;
@@ -73,25 +97,44 @@ typedef struct seqt_sound {
   float volume;
   int32_t loops;
   uint64_t last_note_frame;
+  uint64_t loop_start; // first note column of the loop range
+  uint64_t loop_end; // note column where the loop range wraps, 0 when there is no loop range
+  uint64_t loop_offset; // note steps the clock is ahead of the music position, grows on each wrap
+  uint64_t last_step; // music position of the last polled note step, -1 before the first
+  uint8_t muted_tracks; // bit z is set when track z is muted
   bool paused;
+  seqt_clock clock;
+  seqt_source_index index;
+  riv_waveform_desc *program; // ready to submit waves of every note, by track and column
+  uint32_t program_offsets[SEQT_NOTES_TRACKS][SEQT_NOTES_TOTAL_COLUMNS+1];
 } seqt_sound;
 
-typedef struct seqt_context {
+struct seqt_context {
   seqt_soundfont default_font;
   seqt_sound sounds[SEQT_MAX_SOUNDS+1];
-  uint64_t sound_gen_counter;
-} seqt_context;
+  uint32_t sound_gens[SEQT_MAX_SOUNDS+1]; // bumped when a slot is freed, invalidating its old ids
+  uint32_t free_slots[SEQT_MAX_SOUNDS]; // stack of free slots
+  uint32_t n_free_slots;
+  uint32_t active_slots[SEQT_MAX_SOUNDS]; // slots of playing (not paused) sounds, in no order
+  uint32_t n_active_slots;
+  uint32_t active_positions[SEQT_MAX_SOUNDS+1]; // position in active_slots plus one, 0 when not active
+};
 
 ////////////////////////////////////////////////////////////////////////////////
 // SEQT API
 
-// Global SEQT context
+#ifdef SEQT_GLOBAL_CONTEXT
+// Global SEQT context, for programs that need a single one.
+// Every sound call takes its context, so many independent contexts can run in one process.
 extern seqt_context seqt;
+#endif
 
 // Initialize SEQT context, must be called on initialization.
-SEQT_API void seqt_init(void);
-// Poll all sounds, must be called once every frame.
-SEQT_API void seqt_poll(void);
+SEQT_API void seqt_init(seqt_context *ctx);
+// Poll all playing sounds, must be called once every frame.
+SEQT_API void seqt_poll(seqt_context *ctx);
+// Stop every sound of the context, freeing their memory.
+SEQT_API void seqt_quit(seqt_context *ctx);
 
 ////////////////////////////////////////
 // Sound sources
@@ -102,44 +145,81 @@ SEQT_API seqt_source *seqt_make_source_from_file(const char *filename);
 SEQT_API void seqt_destroy_source(seqt_source *source);
 // Get sound source time length (in seconds)
 SEQT_API double seqt_get_source_length(seqt_source *source);
+// Index which rows have notes in each track column (done by seqt_play for its sound)
+SEQT_API void seqt_make_source_index(seqt_source *source, seqt_source_index *index);
+// Get the first column from x with notes in a track, or SEQT_NOTES_TOTAL_COLUMNS if there is none
+SEQT_API uint64_t seqt_next_note_column(seqt_source_index *index, uint64_t track, uint64_t x);
+
+////////////////////////////////////////
+// Note clock
+
+// Make a clock at frame 0 for a source tempo played at speed and frames per second
+SEQT_API seqt_clock seqt_make_clock(int16_t bpm, double speed, uint64_t fps);
+// Move the clock to an elapsed frame and return its note step, moving to the next frame costs no division
+SEQT_API uint64_t seqt_clock_seek(seqt_clock *clock, uint64_t frame);
+// Advance the clock one frame, returns true when a new note step started
+SEQT_API bool seqt_clock_advance(seqt_clock *clock);
+// Get the first elapsed frame of a note step
+SEQT_API uint64_t seqt_clock_step_frame(const seqt_clock *clock, uint64_t step);
 
 ////////////////////////////////////////
 // Sounds
 
-// Play a sound from a source for loop times and returns its it (negative loops plays forever)
-SEQT_API uint64_t seqt_play(seqt_source *source, int32_t loops);
-// Stop a sound
-SEQT_API void seqt_stop(uint64_t sound_id);
+// Play a sound from a source for loop times and returns its it (negative loops plays forever),
+// the source notes are compiled into waves once here
+SEQT_API uint64_t seqt_play(seqt_context *ctx, seqt_source *source, int32_t loops);
+// Stop a sound right away
+SEQT_API void seqt_stop(seqt_context *ctx, uint64_t sound_id);
 // Set sound start time (in seconds)
-SEQT_API void seqt_set_start(uint64_t sound_id, double secs);
+SEQT_API void seqt_set_start(seqt_context *ctx, uint64_t sound_id, double secs);
 // Set sound stop time (in seconds)
-SEQT_API void seqt_set_stop(uint64_t sound_id, double secs);
+SEQT_API void seqt_set_stop(seqt_context *ctx, uint64_t sound_id, double secs);
 // Seek a sound to a timestamp (in seconds)
-SEQT_API void seqt_seek(uint64_t sound_id, double secs);
+SEQT_API void seqt_seek(seqt_context *ctx, uint64_t sound_id, double secs);
 // Set sound paused
-SEQT_API void seqt_set_paused(uint64_t sound_id, bool paused);
+SEQT_API void seqt_set_paused(seqt_context *ctx, uint64_t sound_id, bool paused);
 // Set sound speed
-SEQT_API void seqt_set_speed(uint64_t sound_id, float speed);
-// Set sound pitch
-SEQT_API void seqt_set_pitch(uint64_t sound_id, float pitch);
-// Set sound volume, values larger than 1 will play louder
-SEQT_API void seqt_set_volume(uint64_t sound_id, float volume);
+SEQT_API void seqt_set_speed(seqt_context *ctx, uint64_t sound_id, float speed);
+// Set sound pitch, recompiles the sound waves when it changes
+SEQT_API void seqt_set_pitch(seqt_context *ctx, uint64_t sound_id, float pitch);
+// Set sound volume, values larger than 1 will play louder, recompiles the sound waves when it changes
+SEQT_API void seqt_set_volume(seqt_context *ctx, uint64_t sound_id, float volume);
+// Loop the note columns [start_column, end_column) of every pass once the sound plays inside them,
+// an empty range clears it and the sound goes on after the last column it looped
+SEQT_API void seqt_set_loop(seqt_context *ctx, uint64_t sound_id, uint64_t start_column, uint64_t end_column);
+// Mute the tracks whose bit is set in mask, muted tracks are not polled
+SEQT_API void seqt_set_muted_tracks(seqt_context *ctx, uint64_t sound_id, uint8_t mask);
 // Get sound elapsed time (in seconds)
-SEQT_API double seqt_get_time(uint64_t sound_id);
+SEQT_API double seqt_get_time(seqt_context *ctx, uint64_t sound_id);
 // Get sound time length of one loop (in seconds)
-SEQT_API double seqt_get_loop_length(uint64_t sound_id);
+SEQT_API double seqt_get_loop_length(seqt_context *ctx, uint64_t sound_id);
 // Check if sound is still valid (not stopped yet)
-SEQT_API bool seqt_is_valid(uint64_t sound_id);
+SEQT_API bool seqt_is_valid(seqt_context *ctx, uint64_t sound_id);
 
 ////////////////////////////////////////
 // Low level API (avoid using)
 
 // Get a sound structure from its id, may return NULL in case it stopped.
-SEQT_API seqt_sound *seqt_get_sound(uint64_t sound_id);
+SEQT_API seqt_sound *seqt_get_sound(seqt_context *ctx, uint64_t sound_id);
 
 // Play a sound note (used internally)
 SEQT_API void seqt_play_note(seqt_synthnote *note);
 
+////////////////////////////////////////
+// Offline rendering (compiled when SEQT_RENDER is defined along SEQT_IMPL)
+
+typedef struct seqt_render_stats {
+  uint64_t n_waves; // waves started
+  uint64_t n_dropped_waves; // waves skipped because all voices were busy
+  uint32_t max_voices; // most waves sounding at the same time
+} seqt_render_stats;
+
+// Render a source into interleaved stereo samples without an audio device, returns the rendered frames.
+// Stops when the last wave ends or max_frames is reached, negative loops renders one loop.
+SEQT_API uint64_t seqt_render_source(seqt_source *source, seqt_soundfont *font, int32_t loops, uint32_t sample_rate, float *samples, uint64_t max_frames, seqt_render_stats *stats);
+// Encode rendered samples as a 16 bits stereo WAV file, returns its size and only writes it when it fits.
+SEQT_API uint64_t seqt_make_wav(const float *samples, uint64_t n_frames, uint32_t sample_rate, uint8_t *wav, uint64_t size);
+
 #endif // SEQT_H
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -148,6 +228,8 @@ SEQT_API void seqt_play_note(seqt_synthnote *note);
 #ifdef SEQT_IMPL
 
 #include <math.h>
+#include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/mman.h>
@@ -156,28 +238,38 @@ static inline uint64_t maxu(uint64_t a, uint64_t b) { return (a >= b) ? a : b; }
 static inline uint64_t minu(uint64_t a, uint64_t b) { return (a <= b) ? a : b; }
 static inline uint64_t clampu(uint64_t a, uint64_t min, uint64_t max) { return minu(maxu(a, min), max); }
 
+#ifdef SEQT_GLOBAL_CONTEXT
 seqt_context seqt;
+#endif
+
+static bool seqt_make_note_wave(seqt_synthnote *note, uint64_t i, riv_waveform_desc *out) {
+  riv_waveform_desc wave = note->synth.waves[i];
+  if (wave.type <= 0 || note->periods <= 0) {
+    return false;
+  }
+  if (wave.start_frequency <= 8.0f && note->start_freq > 0.0f) {
+    wave.start_frequency = wave.start_frequency * note->start_freq;
+  } else if (note->start_freq > 0.0f && note->end_freq > 0.0f) {
+    wave.start_frequency = wave.start_frequency * (note->start_freq/note->end_freq);
+  }
+  if (wave.end_frequency <= 8.0f && note->end_freq > 0.0f) {
+    wave.end_frequency = wave.end_frequency * note->end_freq;
+  }
+  wave.attack = note->periods * wave.attack / note->bps;
+  wave.decay = note->periods * wave.decay / note->bps;
+  wave.sustain = note->periods * wave.sustain / note->bps;
+  wave.release = note->periods * wave.release / note->bps;
+  wave.amplitude = note->amplitude * wave.amplitude;
+  *out = wave;
+  return true;
+}
 
 void seqt_play_note(seqt_synthnote *note) {
   for (uint64_t i = 0; i < SEQT_SYNTH_WAVES; ++i) {
-    riv_waveform_desc wave = note->synth.waves[i];
-    if (wave.type <= 0 || note->periods <= 0) {
-      continue;
-    }
-    if (wave.start_frequency <= 8.0f && note->start_freq > 0.0f) {
-      wave.start_frequency = wave.start_frequency * note->start_freq;
-    } else if (note->start_freq > 0.0f && note->end_freq > 0.0f) {
-      wave.start_frequency = wave.start_frequency * (note->start_freq/note->end_freq);
-    }
-    if (wave.end_frequency <= 8.0f && note->end_freq > 0.0f) {
-      wave.end_frequency = wave.end_frequency * note->end_freq;
+    riv_waveform_desc wave;
+    if (seqt_make_note_wave(note, i, &wave)) {
+      riv_waveform(&wave);
     }
-    wave.attack = note->periods * wave.attack / note->bps;
-    wave.decay = note->periods * wave.decay / note->bps;
-    wave.sustain = note->periods * wave.sustain / note->bps;
-    wave.release = note->periods * wave.release / note->bps;
-    wave.amplitude = note->amplitude * wave.amplitude;
-    riv_waveform(&wave);
   }
 }
 
@@ -189,56 +281,182 @@ static uint64_t seqt_get_source_track_size(seqt_source* source) {
   return track_size;
 }
 
+// Write the waves of every source note, grouped by track and column, returns the number of waves
+static uint32_t seqt_build_program(seqt_sound *sound, riv_waveform_desc *program) {
+  seqt_source *source = sound->source;
+  seqt_soundfont *font = sound->font;
+  double hits_per_second = (source->bpm * SEQT_TIME_SIG)/60.0;
+  uint32_t n_waves = 0;
+  for (uint64_t note_z = 0; note_z < SEQT_NOTES_TRACKS; ++note_z) {
+    for (uint64_t note_x = 0; note_x < SEQT_NOTES_TOTAL_COLUMNS; ++note_x) {
+      sound->program_offsets[note_z][note_x] = n_waves;
+      uint16_t rows = sound->index.row_masks[note_z][note_x];
+      for (uint64_t note_y = 0; rows != 0; ++note_y, rows >>= 1) {
+        if (!(rows & 1)) continue;
+        seqt_note note = source->pages[note_z][note_y][note_x];
+        seqt_synthnote synth_note = {
+          .synth = font->synths[note_z][note_y],
+          .start_freq = font->scale[note_y + 5],
+          .end_freq = font->scale[note_y + 5],
+          .amplitude = powf(2.0f, (note.volume/3.0f)) * sound->volume,
+          .periods = note.periods,
+          .bps = (float)hits_per_second * sound->pitch,
+        };
+        if (note.slide != 0) {
+          synth_note.start_freq = font->scale[clampu((uint64_t)((int64_t)note_y + 5 + note.slide), 0, SEQT_NOTES_SCALE_NOTES-1)];
+        }
+        for (uint64_t i = 0; i < SEQT_SYNTH_WAVES; ++i) {
+          riv_waveform_desc wave;
+          if (seqt_make_note_wave(&synth_note, i, &wave)) {
+            if (program) program[n_waves] = wave;
+            n_waves++;
+          }
+        }
+      }
+    }
+    sound->program_offsets[note_z][SEQT_NOTES_TOTAL_COLUMNS] = n_waves;
+  }
+  return n_waves;
+}
+
+// Compile the sound waves, the program is allocated once and rewritten in place
+static bool seqt_compile_sound(seqt_sound *sound) {
+  if (!sound->program) {
+    uint32_t n_waves = seqt_build_program(sound, NULL);
+    sound->program = (riv_waveform_desc*)malloc(maxu(n_waves, 1) * sizeof(riv_waveform_desc));
+    if (!sound->program) return false;
+  }
+  seqt_build_program(sound, sound->program);
+  return true;
+}
+
+static uint64_t seqt_gcd(uint64_t a, uint64_t b) {
+  while (b != 0) {
+    uint64_t r = a % b;
+    a = b;
+    b = r;
+  }
+  return a;
+}
+
+seqt_clock seqt_make_clock(int16_t bpm, double speed, uint64_t fps) {
+  uint64_t speed_fixed = (uint64_t)(fmax(speed, 0.0) * SEQT_CLOCK_SPEED_ONE + 0.5);
+  uint64_t steps = (uint64_t)(bpm > 0 ? bpm : 0) * SEQT_TIME_SIG * speed_fixed;
+  uint64_t frames = 60 * maxu(fps, 1) * SEQT_CLOCK_SPEED_ONE;
+  uint64_t gcd = seqt_gcd(steps, frames);
+  return (seqt_clock){.steps = steps / gcd, .frames = frames / gcd};
+}
+
+uint64_t seqt_clock_seek(seqt_clock *clock, uint64_t frame) {
+  if (frame == clock->frame + 1) {
+    clock->frame = frame;
+    clock->remainder += clock->steps;
+    while (clock->remainder >= clock->frames) {
+      clock->remainder -= clock->frames;
+      clock->step++;
+    }
+  } else if (frame != clock->frame) {
+    uint64_t total = frame * clock->steps;
+    clock->frame = frame;
+    clock->step = total / clock->frames;
+    clock->remainder = total % clock->frames;
+  }
+  return clock->step;
+}
+
+bool seqt_clock_advance(seqt_clock *clock) {
+  uint64_t step = clock->step;
+  return seqt_clock_seek(clock, clock->frame + 1) != step;
+}
+
+uint64_t seqt_clock_step_frame(const seqt_clock *clock, uint64_t step) {
+  if (clock->steps == 0) return (uint64_t)-1;
+  return (step * clock->frames + clock->steps - 1) / clock->steps;
+}
+
+static void seqt_set_active(seqt_sound *sound, bool active) {
+  seqt_context *ctx = sound->ctx;
+  uint32_t slot = (uint32_t)(sound - ctx->sounds);
+  uint32_t pos = ctx->active_positions[slot];
+  if (active && pos == 0) {
+    ctx->active_slots[ctx->n_active_slots++] = slot;
+    ctx->active_positions[slot] = ctx->n_active_slots;
+  } else if (!active && pos != 0) {
+    // move the last active slot into the hole
+    uint32_t last = ctx->active_slots[--ctx->n_active_slots];
+    ctx->active_slots[pos-1] = last;
+    ctx->active_positions[last] = pos;
+    ctx->active_positions[slot] = 0;
+  }
+}
+
+static void seqt_free_sound(seqt_sound *sound) {
+  seqt_context *ctx = sound->ctx;
+  uint32_t slot = (uint32_t)(sound - ctx->sounds);
+  seqt_set_active(sound, false);
+  free(sound->program);
+  *sound = (seqt_sound){0};
+  ctx->sound_gens[slot]++;
+  ctx->free_slots[ctx->n_free_slots++] = slot;
+}
+
+// Music position of a note step, wrapped back into the loop range when the last step was inside it
+static uint64_t seqt_get_sound_step(seqt_sound *sound, uint64_t note_frame) {
+  uint64_t step = note_frame - minu(sound->loop_offset, note_frame);
+  if (sound->loop_end == 0 || sound->last_step == (uint64_t)-1) return step;
+  uint64_t track_size = seqt_get_source_track_size(sound->source);
+  uint64_t pass = sound->last_step - sound->last_step % track_size;
+  uint64_t start = pass + sound->loop_start, end = pass + sound->loop_end;
+  if (sound->last_step < start || sound->last_step >= end || step < end) return step;
+  uint64_t wrapped = start + (step - start) % (end - start);
+  sound->loop_offset += step - wrapped;
+  return wrapped;
+}
+
 static void seqt_poll_sound(seqt_sound *sound) {
   if (sound->paused) {
     return;
   }
   seqt_source *source = sound->source;
-  double hits_per_second = (source->bpm * SEQT_TIME_SIG)/60.0;
   uint64_t frame = sound->frame + 1;
   if (frame >= sound->stop_frame) {
-    *sound = (seqt_sound){0};
+    seqt_free_sound(sound);
     return;
   }
   sound->frame = frame;
   if (frame < sound->start_frame) return;
-  uint64_t note_frame = (uint64_t)floor(((double)(frame - sound->start_frame) * hits_per_second * sound->speed) / riv->target_fps);
-  // TODO: allow setting loop ranges
+  uint64_t note_frame = seqt_clock_seek(&sound->clock, frame - sound->start_frame);
   if (note_frame == sound->last_note_frame) return;
-  if (sound->loops >= 0 && (note_frame / seqt_get_source_track_size(source)) >= (uint64_t)sound->loops) {
-    *sound = (seqt_sound){0};
+  sound->last_note_frame = note_frame;
+  uint64_t step = seqt_get_sound_step(sound, note_frame);
+  sound->last_step = step;
+  if (sound->loops >= 0 && (step / seqt_get_source_track_size(source)) >= (uint64_t)sound->loops) {
+    seqt_free_sound(sound);
     return;
   }
-  sound->last_note_frame = note_frame;
-  seqt_soundfont *font = sound->font;
-  for (uint64_t note_z = 0; note_z < SEQT_NOTES_TRACKS; ++note_z) {
-    uint64_t note_x = note_frame % maxu(source->track_sizes[note_z], SEQT_NOTES_COLUMNS);
-    // TODO: allow muting tracks
-    for (uint64_t note_y = 0; note_y < SEQT_NOTES_ROWS; ++note_y) {
-      seqt_note note = source->pages[note_z][note_y][note_x];
-      if (note.periods == 0) continue;
-      seqt_synthnote synth_note = {
-        .synth = font->synths[note_z][note_y],
-        .start_freq = font->scale[note_y + 5],
-        .end_freq = font->scale[note_y + 5],
-        .amplitude = powf(2.0f, (note.volume/3.0f)) * sound->volume,
-        .periods = note.periods,
-        .bps = (float)hits_per_second * sound->pitch,
-      };
-      if (note.slide != 0) {
-        synth_note.start_freq = font->scale[clampu((uint64_t)((int64_t)note_y + 5 + note.slide), 0, SEQT_NOTES_SCALE_NOTES-1)];
-      }
-      seqt_play_note(&synth_note);
+  uint32_t tracks = ~(uint32_t)sound->muted_tracks & ((1u << SEQT_NOTES_TRACKS) - 1);
+  for (uint64_t note_z = 0; tracks != 0; ++note_z, tracks >>= 1) {
+    if (!(tracks & 1)) continue;
+    uint64_t note_x = step % maxu(source->track_sizes[note_z], SEQT_NOTES_COLUMNS);
+    if (note_x >= SEQT_NOTES_TOTAL_COLUMNS) continue;
+    uint32_t end = sound->program_offsets[note_z][note_x+1];
+    for (uint32_t i = sound->program_offsets[note_z][note_x]; i < end; ++i) {
+      riv_waveform_desc wave = sound->program[i];
+      riv_waveform(&wave);
     }
   }
 }
 
-void seqt_poll(void) {
-  for (uint64_t i = 1; i <= SEQT_MAX_SOUNDS; ++i) {
-    seqt_sound *sound = &seqt.sounds[i];
-    if (sound->id != 0) {
-      seqt_poll_sound(sound);
-    }
+void seqt_poll(seqt_context *ctx) {
+  // backwards, a sound stopping here is replaced by one already polled
+  for (uint32_t i = ctx->n_active_slots; i > 0; --i) {
+    seqt_poll_sound(&ctx->sounds[ctx->active_slots[i-1]]);
+  }
+}
+
+void seqt_quit(seqt_context *ctx) {
+  for (uint32_t slot = 1; slot <= SEQT_MAX_SOUNDS; ++slot) {
+    if (ctx->sounds[slot].id != 0) seqt_free_sound(&ctx->sounds[slot]);
   }
 }
 
@@ -268,106 +486,165 @@ void seqt_destroy_source(seqt_source *source) {
   munmap(source, sizeof(seqt_source));
 }
 
+void seqt_make_source_index(seqt_source *source, seqt_source_index *index) {
+  *index = (seqt_source_index){0};
+  for (uint64_t note_z = 0; note_z < SEQT_NOTES_TRACKS; ++note_z) {
+    uint64_t n_columns = minu(maxu(source->track_sizes[note_z], SEQT_NOTES_COLUMNS), SEQT_NOTES_TOTAL_COLUMNS);
+    for (uint64_t note_y = 0; note_y < SEQT_NOTES_ROWS; ++note_y) {
+      for (uint64_t note_x = 0; note_x < n_columns; ++note_x) {
+        if (source->pages[note_z][note_y][note_x].periods > 0) {
+          index->row_masks[note_z][note_x] |= (uint16_t)(1 << note_y);
+          index->column_masks[note_z][note_x / 64] |= (uint64_t)1 << (note_x % 64);
+          index->track_notes[note_z]++;
+        }
+      }
+    }
+  }
+}
+
+uint64_t seqt_next_note_column(seqt_source_index *index, uint64_t track, uint64_t x) {
+  for (uint64_t word = x / 64; word < SEQT_COLUMN_MASK_WORDS; ++word) {
+    // drop the columns before x in its word
+    uint64_t bits = index->column_masks[track][word] & (word == x / 64 ? ~(uint64_t)0 << (x % 64) : ~(uint64_t)0);
+    if (bits != 0) return word*64 + (uint64_t)__builtin_ctzll(bits);
+  }
+  return SEQT_NOTES_TOTAL_COLUMNS;
+}
+
 double seqt_get_source_length(seqt_source *source) {
   if (!source) return 0;
   return ((double)seqt_get_source_track_size(source) * 60.0) / (double)(source->bpm * SEQT_TIME_SIG);
 }
 
-uint64_t seqt_play(seqt_source *source, int32_t loops) {
+uint64_t seqt_play(seqt_context *ctx, seqt_source *source, int32_t loops) {
   if (!source) {
     riv_printf("failed to play seqt sound: invalid seqt source\n");
     return 0;
   }
-  for (uint64_t i=1; i <= SEQT_MAX_SOUNDS; ++i) {
-    seqt_sound *sound = &seqt.sounds[i];
-    if (sound->id == 0) {
-      uint64_t id = (seqt.sound_gen_counter++ << 32) | i;
-      *sound = (seqt_sound){
-        .id = id,
-        .font = &seqt.default_font,
-        .source = source,
-        .frame = 0,
-        .start_frame = 0,
-        .stop_frame = (uint64_t)-1,
-        .speed = 1.0,
-        .pitch = 1.0f,
-        .volume = 1.0f,
-        .loops = loops,
-        .last_note_frame = (uint64_t)-1,
-        .paused = false,
-      };
-      return id;
-    }
+  if (ctx->n_free_slots == 0) {
+    riv_printf("failed to play seqt sound: too many sounds\n");
+    return 0;
+  }
+  uint32_t slot = ctx->free_slots[--ctx->n_free_slots];
+  seqt_sound *sound = &ctx->sounds[slot];
+  uint64_t id = ((uint64_t)ctx->sound_gens[slot] << SEQT_SOUND_SLOT_BITS) | slot;
+  *sound = (seqt_sound){
+    .id = id,
+    .ctx = ctx,
+    .font = &ctx->default_font,
+    .source = source,
+    .frame = 0,
+    .start_frame = 0,
+    .stop_frame = (uint64_t)-1,
+    .speed = 1.0,
+    .pitch = 1.0f,
+    .volume = 1.0f,
+    .loops = loops,
+    .last_note_frame = (uint64_t)-1,
+    .last_step = (uint64_t)-1,
+    .paused = false,
+    .clock = seqt_make_clock(source->bpm, 1.0, riv->target_fps),
+  };
+  seqt_make_source_index(source, &sound->index);
+  if (!seqt_compile_sound(sound)) {
+    riv_printf("failed to play seqt sound: out of memory\n");
+    seqt_free_sound(sound);
+    return 0;
   }
-  riv_printf("failed to play seqt sound: too many sounds\n");
-  return 0;
+  seqt_set_active(sound, true);
+  return id;
 }
 
-void seqt_stop(uint64_t sound_id) {
-  seqt_set_stop(sound_id, 0);
+void seqt_stop(seqt_context *ctx, uint64_t sound_id) {
+  seqt_sound *sound = seqt_get_sound(ctx, sound_id);
+  if (!sound) return;
+  seqt_free_sound(sound);
 }
 
-void seqt_set_start(uint64_t sound_id, double time) {
-  seqt_sound *sound = seqt_get_sound(sound_id);
+void seqt_set_start(seqt_context *ctx, uint64_t sound_id, double time) {
+  seqt_sound *sound = seqt_get_sound(ctx, sound_id);
   if (!sound) return;
   sound->start_frame = (uint64_t)(fmax(time, 0.0) * riv->target_fps);
 }
 
-void seqt_set_stop(uint64_t sound_id, double time) {
-  seqt_sound *sound = seqt_get_sound(sound_id);
+void seqt_set_stop(seqt_context *ctx, uint64_t sound_id, double time) {
+  seqt_sound *sound = seqt_get_sound(ctx, sound_id);
   if (!sound) return;
   sound->stop_frame = (uint64_t)(fmax(time, 0.0) * riv->target_fps);
 }
 
-void seqt_seek(uint64_t sound_id, double time) {
-  seqt_sound *sound = seqt_get_sound(sound_id);
+void seqt_seek(seqt_context *ctx, uint64_t sound_id, double time) {
+  seqt_sound *sound = seqt_get_sound(ctx, sound_id);
   if (!sound) return;
   sound->frame = (uint64_t)(fmax(time, 0.0) * riv->target_fps);
+  // the music position follows the clock again
+  sound->loop_offset = 0;
+  sound->last_step = (uint64_t)-1;
 }
 
-void seqt_set_paused(uint64_t sound_id, bool paused) {
-  seqt_sound *sound = seqt_get_sound(sound_id);
+void seqt_set_paused(seqt_context *ctx, uint64_t sound_id, bool paused) {
+  seqt_sound *sound = seqt_get_sound(ctx, sound_id);
   if (!sound) return;
   sound->paused = paused;
+  seqt_set_active(sound, !paused);
 }
 
-void seqt_set_speed(uint64_t sound_id, float speed) {
-  seqt_sound *sound = seqt_get_sound(sound_id);
+void seqt_set_speed(seqt_context *ctx, uint64_t sound_id, float speed) {
+  seqt_sound *sound = seqt_get_sound(ctx, sound_id);
   if (!sound) return;
   sound->speed = (double)speed;
+  sound->clock = seqt_make_clock(sound->source->bpm, sound->speed, riv->target_fps);
 }
 
-void seqt_set_pitch(uint64_t sound_id, float pitch) {
-  seqt_sound *sound = seqt_get_sound(sound_id);
-  if (!sound) return;
+void seqt_set_pitch(seqt_context *ctx, uint64_t sound_id, float pitch) {
+  seqt_sound *sound = seqt_get_sound(ctx, sound_id);
+  if (!sound || sound->pitch == pitch) return;
   sound->pitch = pitch;
+  seqt_compile_sound(sound);
 }
 
-void seqt_set_volume(uint64_t sound_id, float volume) {
-  seqt_sound *sound = seqt_get_sound(sound_id);
-  if (!sound) return;
+void seqt_set_volume(seqt_context *ctx, uint64_t sound_id, float volume) {
+  seqt_sound *sound = seqt_get_sound(ctx, sound_id);
+  if (!sound || sound->volume == volume) return;
   sound->volume = volume;
+  seqt_compile_sound(sound);
+}
+
+void seqt_set_loop(seqt_context *ctx, uint64_t sound_id, uint64_t start_column, uint64_t end_column) {
+  seqt_sound *sound = seqt_get_sound(ctx, sound_id);
+  if (!sound) return;
+  end_column = minu(end_column, seqt_get_source_track_size(sound->source));
+  bool empty = end_column <= start_column;
+  sound->loop_start = empty ? 0 : start_column;
+  sound->loop_end = empty ? 0 : end_column;
+}
+
+void seqt_set_muted_tracks(seqt_context *ctx, uint64_t sound_id, uint8_t mask) {
+  seqt_sound *sound = seqt_get_sound(ctx, sound_id);
+  if (!sound) return;
+  sound->muted_tracks = mask;
 }
 
-double seqt_get_time(uint64_t sound_id) {
-  seqt_sound *sound = seqt_get_sound(sound_id);
+double seqt_get_time(seqt_context *ctx, uint64_t sound_id) {
+  seqt_sound *sound = seqt_get_sound(ctx, sound_id);
   if (!sound) return 0;
   return (double)sound->frame / riv->target_fps;
 }
 
-double seqt_get_loop_length(uint64_t sound_id) {
-  seqt_sound *sound = seqt_get_sound(sound_id);
+double seqt_get_loop_length(seqt_context *ctx, uint64_t sound_id) {
+  seqt_sound *sound = seqt_get_sound(ctx, sound_id);
   if (!sound) return 0;
   return seqt_get_source_length(sound->source) * sound->speed;
 }
 
-bool seqt_is_valid(uint64_t sound_id) {
-  return seqt_get_sound(sound_id) != NULL;
+bool seqt_is_valid(seqt_context *ctx, uint64_t sound_id) {
+  return seqt_get_sound(ctx, sound_id) != NULL;
 }
 
-seqt_sound *seqt_get_sound(uint64_t sound_id) {
-  if (sound_id == 0) return NULL;
-  seqt_sound *sound = &seqt.sounds[sound_id & (SEQT_MAX_SOUNDS-1)];
+seqt_sound *seqt_get_sound(seqt_context *ctx, uint64_t sound_id) {
+  uint64_t slot = sound_id & (((uint64_t)1 << SEQT_SOUND_SLOT_BITS) - 1);
+  if (slot == 0 || slot > SEQT_MAX_SOUNDS) return NULL;
+  seqt_sound *sound = &ctx->sounds[slot];
   return (sound->id == sound_id) ? sound : NULL;
 }
 
@@ -382,7 +659,7 @@ static void seqt_fill_major_pentatonic_scale(float scale[SEQT_NOTES_SCALE_NOTES]
   }
 }
 
-void seqt_init(void) {
+void seqt_init(seqt_context *ctx) {
   // Instruments
   seqt_synth STRINGS_WAVE = {.waves = {{
     .type = RIV_WAVEFORM_TRIANGLE,
@@ -526,7 +803,7 @@ void seqt_init(void) {
   }}};
 
   // Synths
-  seqt.default_font = (seqt_soundfont){.synths = {
+  ctx->default_font = (seqt_soundfont){.synths = {
     {STRINGS_WAVE,STRINGS_WAVE,STRINGS_WAVE,STRINGS_WAVE,STRINGS_WAVE,STRINGS_WAVE,STRINGS_WAVE,STRINGS_WAVE,STRINGS_WAVE,STRINGS_WAVE},
     {LEAD_WAVE,LEAD_WAVE,LEAD_WAVE,LEAD_WAVE,LEAD_WAVE,LEAD_WAVE,LEAD_WAVE,LEAD_WAVE,LEAD_WAVE,LEAD_WAVE},
     {BASS_WAVE,BASS_WAVE,BASS_WAVE,BASS_WAVE,BASS_WAVE,BASS_WAVE,BASS_WAVE,BASS_WAVE,BASS_WAVE,BASS_WAVE},
@@ -535,7 +812,279 @@ void seqt_init(void) {
 
   // Scale
   int scale_semitone_index = 39; // Eb
-  seqt_fill_major_pentatonic_scale(seqt.default_font.scale, scale_semitone_index);
+  seqt_fill_major_pentatonic_scale(ctx->default_font.scale, scale_semitone_index);
+
+  // Sound slots, popped lowest first
+  ctx->n_free_slots = 0;
+  for (uint32_t slot = SEQT_MAX_SOUNDS; slot >= 1; --slot) {
+    if (ctx->sounds[slot].id == 0) ctx->free_slots[ctx->n_free_slots++] = slot;
+  }
+  ctx->n_active_slots = 0;
+  for (uint32_t slot = 1; slot <= SEQT_MAX_SOUNDS; ++slot) {
+    ctx->active_positions[slot] = 0;
+    if (ctx->sounds[slot].id != 0) ctx->sounds[slot].ctx = ctx;
+    if (ctx->sounds[slot].id != 0 && !ctx->sounds[slot].paused) seqt_set_active(&ctx->sounds[slot], true);
+  }
 }
 
+#ifdef SEQT_RENDER
+
+enum {
+  SEQT_RENDER_MAX_VOICES = 256,
+  SEQT_RENDER_BLOCK_FRAMES = 256,
+};
+
+typedef struct seqt_render_voice {
+  riv_waveform_desc wave;
+  uint64_t start_frame;
+  uint64_t length; // in frames
+  float phase;
+  float noise;
+  uint32_t noise_state;
+} seqt_render_voice;
+
+// Oscillator shapes approximating the RIV ones, phase in [0,1)
+static float seqt_render_triangle(float phase, float rise) {
+  if (rise <= 0.0f) return 1.0f - 2.0f*phase;
+  if (rise >= 1.0f) return -1.0f + 2.0f*phase;
+  return (phase < rise) ? -1.0f + 2.0f*phase/rise : 1.0f - 2.0f*(phase - rise)/(1.0f - rise);
+}
+
+// Sine of a phase in [0,1), a parabola refined once (error below 0.001) so the loop vectorizes
+static float seqt_render_sine(float phase) {
+  float t = phase - 0.5f;
+  float y = 16.0f*t*fabsf(t) - 8.0f*t;
+  return 0.225f*(y*fabsf(y) - y) + y;
+}
+
+// Phases of the next n voice samples from sample k0, with phases[n] the phase after them.
+// The frequency sweeps linearly over the voice length, so each phase is a closed form of
+// its sample and the loop carries no state.
+static void seqt_render_phases(seqt_render_voice *voice, float *phases, uint64_t k0, uint64_t n, uint32_t sample_rate) {
+  riv_waveform_desc *wave = &voice->wave;
+  float inv_rate = 1.0f / (float)sample_rate;
+  float sweep = (wave->end_frequency - wave->start_frequency) / (float)voice->length; // per sample
+  float step = (wave->start_frequency + sweep*(float)k0) * inv_rate;
+  float accel = 0.5f * sweep * inv_rate;
+  float phase = voice->phase;
+  for (int32_t i = 0; i <= (int32_t)n; ++i) {
+    float fi = (float)i;
+    float p = phase + fi*(step + accel*(fi - 1.0f));
+    phases[i] = p - (float)(int32_t)p;
+  }
+}
+
+static void seqt_render_triangles(const float *phases, float *out, uint64_t n, float rise) {
+  if (rise <= 0.0f || rise >= 1.0f) {
+    for (int32_t i = 0; i < (int32_t)n; ++i) out[i] = seqt_render_triangle(phases[i], rise);
+    return;
+  }
+  float up = 2.0f / rise;
+  float down = 2.0f / (1.0f - rise);
+  for (int32_t i = 0; i < (int32_t)n; ++i) {
+    float p = phases[i];
+    float rising = -1.0f + up*p;
+    float falling = 1.0f - down*(p - rise);
+    // a select through a 0/1 factor, a branch here keeps the loop scalar
+    float is_rising = (float)(p < rise);
+    out[i] = falling + is_rising*(rising - falling);
+  }
+}
+
+// Shape of n samples, one loop per shape
+static void seqt_render_shapes(seqt_render_voice *voice, const float *phases, float *out, uint64_t n) {
+  float duty = voice->wave.duty_cycle;
+  switch (voice->wave.type) {
+  case RIV_WAVEFORM_SINE:
+    for (uint64_t i = 0; i < n; ++i) out[i] = seqt_render_sine(phases[i]);
+    break;
+  case RIV_WAVEFORM_PULSE:
+    for (uint64_t i = 0; i < n; ++i) out[i] = (phases[i] < duty) ? 1.0f : -1.0f;
+    break;
+  case RIV_WAVEFORM_TRIANGLE:
+    seqt_render_triangles(phases, out, n, 0.5f);
+    break;
+  case RIV_WAVEFORM_TILTED_SAWTOOTH:
+    seqt_render_triangles(phases, out, n, duty);
+    break;
+  case RIV_WAVEFORM_ORGAN: {
+    float second[SEQT_RENDER_BLOCK_FRAMES];
+    for (uint64_t i = 0; i < n; ++i) {
+      float p = 2.0f*phases[i];
+      second[i] = p - (float)(int32_t)p;
+    }
+    seqt_render_triangles(phases, out, n, 0.5f);
+    seqt_render_triangles(second, second, n, 0.5f);
+    for (uint64_t i = 0; i < n; ++i) out[i] = 0.5f*(out[i] + second[i]);
+    break;
+  }
+  case RIV_WAVEFORM_NOISE:
+    // a new random value each time the phase wraps, the generator makes this one serial
+    for (uint64_t i = 0; i < n; ++i) {
+      out[i] = voice->noise;
+      if (phases[i+1] < phases[i]) {
+        voice->noise_state ^= voice->noise_state << 13;
+        voice->noise_state ^= voice->noise_state >> 17;
+        voice->noise_state ^= voice->noise_state << 5;
+        voice->noise = (float)(voice->noise_state >> 8) / 8388608.0f - 1.0f;
+      }
+    }
+    break;
+  default:
+    for (uint64_t i = 0; i < n; ++i) out[i] = 0.0f;
+    break;
+  }
+}
+
+// Envelope of n samples from voice sample k0. The ADSR is piecewise linear,
+// so each segment inside the range is filled with a ramp.
+static void seqt_render_envelope(riv_waveform_desc *wave, float *out, uint64_t k0, uint64_t n, uint32_t sample_rate) {
+  float inv_rate = 1.0f / (float)sample_rate;
+  float sustain_level = wave->sustain_level;
+  float ends[4] = {
+    wave->attack,
+    wave->attack + wave->decay,
+    wave->attack + wave->decay + wave->sustain,
+    wave->attack + wave->decay + wave->sustain + wave->release,
+  };
+  // level at the segment start and its slope per second, empty segments are never filled
+  float levels[5] = {0.0f, 1.0f, sustain_level, sustain_level, 0.0f};
+  float slopes[5] = {1.0f / wave->attack, -(1.0f - sustain_level) / wave->decay, 0.0f, -sustain_level / wave->release, 0.0f};
+  uint64_t i = 0;
+  for (int segment = 0; segment < 5 && i < n; ++segment) {
+    float begin = segment > 0 ? ends[segment-1] : 0.0f;
+    uint64_t end = n;
+    if (segment < 4) {
+      uint64_t end_k = (uint64_t)ceilf(ends[segment] * (float)sample_rate);
+      end = clampu(end_k > k0 ? end_k - k0 : 0, i, n);
+    }
+    float level = levels[segment];
+    float slope = slopes[segment];
+    float t = (float)k0*inv_rate - begin;
+    for (int32_t j = (int32_t)i; j < (int32_t)end; ++j) out[j] = level + slope * (t + (float)j*inv_rate);
+    i = end;
+  }
+}
+
+// Mix a voice into a block, returns false once the voice ended.
+// The shape, the envelope and the pan are each one pass over the voice samples of the block.
+static bool seqt_render_mix_voice(seqt_render_voice *voice, float *block, uint64_t block_frame, uint64_t n_frames, uint32_t sample_rate) {
+  riv_waveform_desc *wave = &voice->wave;
+  float left = wave->amplitude * ((wave->pan > 0.0f) ? 1.0f - wave->pan : 1.0f);
+  float right = wave->amplitude * ((wave->pan < 0.0f) ? 1.0f + wave->pan : 1.0f);
+  uint64_t first = (voice->start_frame > block_frame) ? voice->start_frame - block_frame : 0;
+  uint64_t k0 = block_frame + first - voice->start_frame;
+  if (k0 >= voice->length) return false;
+  uint64_t n = minu(n_frames - first, voice->length - k0);
+  float phases[SEQT_RENDER_BLOCK_FRAMES+1];
+  float shapes[SEQT_RENDER_BLOCK_FRAMES];
+  float envelope[SEQT_RENDER_BLOCK_FRAMES];
+  seqt_render_phases(voice, phases, k0, n, sample_rate);
+  seqt_render_shapes(voice, phases, shapes, n);
+  seqt_render_envelope(wave, envelope, k0, n, sample_rate);
+  float *out = &block[2*first];
+  for (uint64_t i = 0; i < n; ++i) {
+    float sample = shapes[i] * envelope[i];
+    out[2*i] += sample * left;
+    out[2*i+1] += sample * right;
+  }
+  voice->phase = phases[n];
+  return k0 + n < voice->length;
+}
+
+uint64_t seqt_render_source(seqt_source *source, seqt_soundfont *font, int32_t loops, uint32_t sample_rate, float *samples, uint64_t max_frames, seqt_render_stats *stats) {
+  seqt_render_voice voices[SEQT_RENDER_MAX_VOICES];
+  seqt_render_stats render_stats = {0};
+  if (!source || !font || sample_rate == 0) return 0;
+  seqt_sound sound = {
+    .font = font,
+    .source = source,
+    .speed = 1.0,
+    .pitch = 1.0f,
+    .volume = 1.0f,
+  };
+  seqt_make_source_index(source, &sound.index);
+  if (!seqt_compile_sound(&sound)) return 0;
+
+  double hits_per_second = (source->bpm * SEQT_TIME_SIG)/60.0;
+  uint64_t n_steps = seqt_get_source_track_size(source) * (uint64_t)(loops >= 0 ? loops : 1);
+  uint64_t step = 0;
+  uint32_t n_voices = 0;
+  uint64_t frame = 0;
+  while (frame < max_frames && (step < n_steps || n_voices > 0)) {
+    uint64_t n_frames = minu(SEQT_RENDER_BLOCK_FRAMES, max_frames - frame);
+    // start the waves of the note steps inside this block
+    for (; step < n_steps; ++step) {
+      uint64_t step_frame = (uint64_t)floor((double)step * sample_rate / hits_per_second + 0.5);
+      if (step_frame >= frame + n_frames) break;
+      for (uint64_t note_z = 0; note_z < SEQT_NOTES_TRACKS; ++note_z) {
+        uint64_t note_x = step % maxu(source->track_sizes[note_z], SEQT_NOTES_COLUMNS);
+        if (note_x >= SEQT_NOTES_TOTAL_COLUMNS) continue;
+        for (uint32_t i = sound.program_offsets[note_z][note_x]; i < sound.program_offsets[note_z][note_x+1]; ++i) {
+          riv_waveform_desc *wave = &sound.program[i];
+          float duration = wave->attack + wave->decay + wave->sustain + wave->release;
+          render_stats.n_waves++;
+          if (n_voices == SEQT_RENDER_MAX_VOICES) {
+            render_stats.n_dropped_waves++;
+            continue;
+          }
+          voices[n_voices++] = (seqt_render_voice){
+            .wave = *wave,
+            .start_frame = step_frame,
+            .length = maxu((uint64_t)(duration * sample_rate), 1),
+            .noise_state = 0x9e3779b9u ^ (uint32_t)render_stats.n_waves,
+          };
+        }
+      }
+    }
+    if (n_voices > render_stats.max_voices) render_stats.max_voices = n_voices;
+
+    // mix the block, removing ended voices
+    float *block = &samples[2*frame];
+    for (uint64_t i = 0; i < 2*n_frames; ++i) block[i] = 0.0f;
+    for (uint32_t v = 0; v < n_voices;) {
+      if (voices[v].start_frame >= frame + n_frames) {
+        v++;
+      } else if (seqt_render_mix_voice(&voices[v], block, frame, n_frames, sample_rate)) {
+        v++;
+      } else {
+        voices[v] = voices[--n_voices];
+      }
+    }
+    frame += n_frames;
+  }
+  free(sound.program);
+  if (stats) *stats = render_stats;
+  return frame;
+}
+
+static void seqt_put_le(uint8_t *data, uint64_t value, uint64_t n_bytes) {
+  for (uint64_t i = 0; i < n_bytes; ++i) data[i] = (uint8_t)(value >> (8*i));
+}
+
+uint64_t seqt_make_wav(const float *samples, uint64_t n_frames, uint32_t sample_rate, uint8_t *wav, uint64_t size) {
+  uint64_t data_size = n_frames * 4;
+  uint64_t wav_size = 44 + data_size;
+  if (!wav || size < wav_size) return wav_size;
+  memcpy(wav, "RIFF", 4);
+  seqt_put_le(wav + 4, wav_size - 8, 4);
+  memcpy(wav + 8, "WAVEfmt ", 8);
+  seqt_put_le(wav + 16, 16, 4); // fmt chunk size
+  seqt_put_le(wav + 20, 1, 2); // PCM
+  seqt_put_le(wav + 22, 2, 2); // channels
+  seqt_put_le(wav + 24, sample_rate, 4);
+  seqt_put_le(wav + 28, sample_rate * 4, 4); // byte rate
+  seqt_put_le(wav + 32, 4, 2); // block align
+  seqt_put_le(wav + 34, 16, 2); // bits per sample
+  memcpy(wav + 36, "data", 4);
+  seqt_put_le(wav + 40, data_size, 4);
+  for (uint64_t i = 0; i < 2*n_frames; ++i) {
+    float sample = fminf(fmaxf(samples[i], -1.0f), 1.0f);
+    seqt_put_le(wav + 44 + 2*i, (uint16_t)(int16_t)(sample * 32767.0f), 2);
+  }
+  return wav_size;
+}
+
+#endif // SEQT_RENDER
+
 #endif // SEQT_IMPL
@@ -0,0 +1,420 @@
+// Microbenchmarks of the game and seqt hot paths on synthetic songs: a sparse one
+// (one note per beat) and a dense one (every row of every column of all tracks).
+//   frame               update_game and draw_game per frame, for 1 to 6 columns and each focus track
+//   live_notes          update_game and draw_game per frame with 1 to 256 live notes in every lane
+//   build_lane_mappings one rebuild of the lane mappings
+//   seqt_poll_sound     one frame of music
+//   seqt_play_note      one note of each track
+//   read_incard_data    indexing a MICS bundle of 64 songs
+// Each benchmark runs several repeats and reports the median, min and max ns per
+// operation, plus user instructions per operation when perf counters can be opened.
+// Results also go to a JSON file to compare releases.
+// usage: bench [-repeats n] [-frames n] [-o bench.json]
+#define main rhythm_main
+#include "rhythm.c"
+#undef main
+
+#include "riv_host.h"
+#include <stdio.h>
+#include <time.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+enum {
+    BENCH_MAX_REPEATS = 64,
+    BENCH_MAX_RESULTS = 128,
+    BENCH_LOOPS = 1000, // the song never ends while measuring
+    BENCH_WARMUP_FRAMES = 120,
+    BENCH_BUNDLE_SONGS = 64,
+    BENCH_CALLS = 1000, // calls per repeat of the benchmarks that are not per frame
+    BENCH_NOTES_COUNTS = 4,
+};
+
+static const int bench_notes_counts[BENCH_NOTES_COUNTS] = {1, 8, 64, 256};
+
+typedef struct bench_result {
+    char name[32];
+    const char *source;
+    int n_cols; // 0 when it doesn't apply
+    int track; // -1 when it doesn't apply
+    int n_notes; // live notes per lane, 0 when it doesn't apply
+    const char *unit;
+    int n_repeats;
+    double ns[BENCH_MAX_REPEATS]; // per operation, one per repeat
+    double instructions[BENCH_MAX_REPEATS];
+} bench_result;
+
+// Time and instructions spent between start and stop, summed over many intervals
+typedef struct bench_timer {
+    uint64_t ns;
+    uint64_t instructions;
+    uint64_t start_ns;
+    uint64_t start_instructions;
+} bench_timer;
+
+static riv_host host;
+static int instructions_fd = -1;
+static bench_result results[BENCH_MAX_RESULTS];
+static int n_results;
+static int n_repeats = 5;
+static int n_frames = 600;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// user space instructions retired by this thread, missing perf counters leave it at -1
+static void open_instructions_counter(void) {
+    struct perf_event_attr attr = {
+        .type = PERF_TYPE_HARDWARE,
+        .size = sizeof(attr),
+        .config = PERF_COUNT_HW_INSTRUCTIONS,
+        .exclude_kernel = 1,
+        .exclude_hv = 1,
+    };
+    instructions_fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static uint64_t read_instructions(void) {
+    uint64_t count = 0;
+    if (instructions_fd >= 0 && read(instructions_fd, &count, sizeof(count)) != sizeof(count)) count = 0;
+    return count;
+}
+
+static void timer_start(bench_timer *timer) {
+    timer->start_instructions = read_instructions();
+    timer->start_ns = now_ns();
+}
+
+static void timer_stop(bench_timer *timer) {
+    uint64_t ns = now_ns();
+    timer->ns += ns - timer->start_ns;
+    timer->instructions += read_instructions() - timer->start_instructions;
+}
+
+static bench_result *add_result(const char *name, const char *source, int n_cols, int track, const char *unit) {
+    bench_result *result = &results[n_results++];
+    *result = (bench_result){.source = source, .n_cols = n_cols, .track = track, .unit = unit};
+    snprintf(result->name, sizeof(result->name), "%s", name);
+    return result;
+}
+
+static void add_repeat(bench_result *result, const bench_timer *timer, uint64_t n_ops) {
+    result->ns[result->n_repeats] = (double)timer->ns / n_ops;
+    result->instructions[result->n_repeats] = (double)timer->instructions / n_ops;
+    result->n_repeats++;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static double median(const double *values, int n) {
+    double sorted[BENCH_MAX_REPEATS];
+    memcpy(sorted, values, n * sizeof(double));
+    qsort(sorted, n, sizeof(double), compare_doubles);
+    return n % 2 ? sorted[n/2] : 0.5*(sorted[n/2 - 1] + sorted[n/2]);
+}
+
+static double min_value(const double *values, int n) {
+    double m = values[0];
+    for (int i = 1; i < n; i++) m = fmin(m, values[i]);
+    return m;
+}
+
+static double max_value(const double *values, int n) {
+    double m = values[0];
+    for (int i = 1; i < n; i++) m = fmax(m, values[i]);
+    return m;
+}
+
+// sparse: one note per beat walking down the rows, dense: every row and column of all tracks
+static seqt_source *make_bench_source(bool dense) {
+    seqt_source *source = calloc(1, sizeof(seqt_source));
+    if (!source) return NULL;
+    memcpy(source->magic, "SEQT", MAGIC_SIZE);
+    source->bpm = 120;
+    for (int t = 0; t < SEQT_NOTES_TRACKS; t++) {
+        source->track_sizes[t] = SEQT_NOTES_TOTAL_COLUMNS;
+        for (int x = 0; x < SEQT_NOTES_TOTAL_COLUMNS; x++) {
+            for (int y = 0; y < SEQT_NOTES_ROWS; y++) {
+                bool note = dense || (x % SEQT_TIME_SIG == 0 && y == (x / SEQT_TIME_SIG) % SEQT_NOTES_ROWS);
+                if (note) source->pages[t][y][x] = (seqt_note){.periods = 2};
+            }
+        }
+    }
+    return source;
+}
+
+// MICS bundle of songs alternating between the two sources
+static uint8_t *make_bench_bundle(seqt_source **sources, uint32_t *len) {
+    uint32_t header = 2*MAGIC_SIZE*(1 + BENCH_BUNDLE_SONGS);
+    *len = header + BENCH_BUNDLE_SONGS * sizeof(seqt_source);
+    uint8_t *data = malloc(*len);
+    if (!data) return NULL;
+    memcpy(data, "MICS", MAGIC_SIZE);
+    for (int b = 0; b < 4; b++) data[MAGIC_SIZE + b] = (uint8_t)(BENCH_BUNDLE_SONGS >> (24 - 8*b));
+    for (uint32_t i = 0; i < BENCH_BUNDLE_SONGS; i++) {
+        uint32_t offset = header + i * sizeof(seqt_source);
+        uint32_t size = sizeof(seqt_source);
+        uint8_t *pair = data + 2*MAGIC_SIZE*(1 + i);
+        for (int b = 0; b < 4; b++) {
+            pair[b] = (uint8_t)(offset >> (24 - 8*b));
+            pair[MAGIC_SIZE + b] = (uint8_t)(size >> (24 - 8*b));
+        }
+        memcpy(data + offset, sources[i % 2], sizeof(seqt_source));
+    }
+    return data;
+}
+
+// lane keys pressed now and then, so frames see hits, misses and bad presses
+static uint16_t bench_keys(uint64_t frame, int n_cols) {
+    uint16_t down = 0;
+    for (int c = 0; c < n_cols; c++) {
+        uint64_t h = (frame / 3) * 0x9e3779b97f4a7c15ull + (uint64_t)c * 0xbf58476d1ce4e5b9ull;
+        h ^= h >> 31;
+        if (h % 8 == 0) down |= (uint16_t)(1 << key_codes[c]);
+    }
+    return down;
+}
+
+// A game on the source, past the start screen and the random wait
+static bool start_bench_game(game_state *game, seqt_source *source, int n_cols, int track) {
+    riv_host_start(&host, NULL, NULL, 0, 0);
+    host.quiet = true;
+    init_game_state(game);
+    game->n_cols = n_cols;
+    game->focus_track = track;
+    game->n_loops = BENCH_LOOPS;
+    game->max_misses = 0;
+    game->songs[game->n_songs++] = (catalog_song){
+        .source = source,
+        .size = sizeof(seqt_source),
+        .hash = word_hash((uint8_t*)source, sizeof(seqt_source)),
+    };
+    initialize(game);
+    for (int f = 0; !game->started && f < 10 * RIV_HOST_FPS; f++) {
+        update(game);
+        riv_host_step(&host, riv->frame % 2 ? 0 : (uint16_t)(1 << RIV_GAMEPAD1_A1));
+    }
+    for (int f = 0; game->started && f < BENCH_WARMUP_FRAMES; f++) {
+        update(game);
+        riv_host_step(&host, bench_keys(riv->frame, n_cols));
+    }
+    return game->started && !game->ended;
+}
+
+static void bench_frames(game_state *game, seqt_source *source, const char *source_name) {
+    for (int n_cols = 1; n_cols <= MAX_COLS; n_cols++) {
+        for (int track = 0; track < SEQT_NOTES_TRACKS; track++) {
+            bench_result *update_result = add_result("update_game", source_name, n_cols, track, "frame");
+            bench_result *draw_result = add_result("draw_game", source_name, n_cols, track, "frame");
+            if (!start_bench_game(game, source, n_cols, track)) {
+                fprintf(stderr, "failed to start a game with %d columns on track %d\n", n_cols, track);
+                exit(2);
+            }
+            for (int r = 0; r < n_repeats; r++) {
+                bench_timer update_timer = {0}, draw_timer = {0};
+                for (int f = 0; f < n_frames; f++) {
+                    riv_host_step(&host, bench_keys(riv->frame + 1, n_cols));
+                    timer_start(&update_timer);
+                    update_game(game);
+                    timer_stop(&update_timer);
+                    timer_start(&draw_timer);
+                    draw_game(game);
+                    timer_stop(&draw_timer);
+                }
+                add_repeat(update_result, &update_timer, n_frames);
+                add_repeat(draw_result, &draw_timer, n_frames);
+            }
+            release_game(game);
+        }
+    }
+}
+
+// n notes in every arrow and tick lane spread over the screen from the top, their
+// targets are all ahead of the frame so none is judged or missed while measuring
+static void fill_lane(lane_queue *lane, int n_notes) {
+    int frame = (int)riv->frame;
+    lane_clear(lane);
+    for (int k = 0; k < n_notes; k++) {
+        int age = (n_notes - 1 - k) * (SCREEN_SIZE - TILE_SIZE) / n_notes;
+        lane_push(lane, frame - age, SCREEN_SIZE-1, frame + BENCH_WARMUP_FRAMES + k);
+    }
+}
+
+static void fill_lanes(game_state *game, int n_notes) {
+    for (int c = 0; c < game->n_cols; c++) fill_lane(&game->sliding_arrows[c], n_notes);
+    for (int t = 0; t < MAX_TICKS; t++) fill_lane(&game->sliding_ticks[t], n_notes);
+}
+
+// the lanes are refilled before every frame, so the cost only follows the live notes
+static void bench_live_notes(game_state *game, seqt_source *source, const char *source_name) {
+    if (!start_bench_game(game, source, MAX_COLS, 0)) {
+        fprintf(stderr, "failed to start a game with %d columns\n", MAX_COLS);
+        exit(2);
+    }
+    for (int i = 0; i < BENCH_NOTES_COUNTS; i++) {
+        int n_notes = bench_notes_counts[i];
+        bench_result *update_result = add_result("update_game", source_name, MAX_COLS, 0, "frame");
+        bench_result *draw_result = add_result("draw_game", source_name, MAX_COLS, 0, "frame");
+        update_result->n_notes = draw_result->n_notes = n_notes;
+        for (int r = 0; r < n_repeats; r++) {
+            bench_timer update_timer = {0}, draw_timer = {0};
+            for (int f = 0; f < n_frames; f++) {
+                riv_host_step(&host, 0);
+                fill_lanes(game, n_notes);
+                timer_start(&update_timer);
+                update_game(game);
+                timer_stop(&update_timer);
+                timer_start(&draw_timer);
+                draw_game(game);
+                timer_stop(&draw_timer);
+            }
+            add_repeat(update_result, &update_timer, n_frames);
+            add_repeat(draw_result, &draw_timer, n_frames);
+        }
+    }
+    release_game(game);
+}
+
+static void bench_lane_mappings(game_state *game, seqt_source *source, const char *source_name) {
+    bench_result *result = add_result("build_lane_mappings", source_name, MAX_COLS, -1, "call");
+    start_bench_game(game, source, MAX_COLS, 0);
+    for (int r = 0; r < n_repeats; r++) {
+        bench_timer timer = {0};
+        timer_start(&timer);
+        for (int i = 0; i < BENCH_CALLS; i++) build_lane_mappings(game);
+        timer_stop(&timer);
+        add_repeat(result, &timer, BENCH_CALLS);
+    }
+    release_game(game);
+}
+
+static void bench_poll_sound(seqt_context *ctx, seqt_source *source, const char *source_name) {
+    bench_result *result = add_result("seqt_poll_sound", source_name, 0, -1, "frame");
+    riv_host_start(&host, NULL, NULL, 0, 0);
+    seqt_init(ctx);
+    seqt_sound *sound = seqt_get_sound(ctx, seqt_play(ctx, source, -1));
+    for (int r = 0; sound && r < n_repeats; r++) {
+        bench_timer timer = {0};
+        timer_start(&timer);
+        for (int f = 0; f < n_frames; f++) {
+            riv_host_step(&host, 0);
+            seqt_poll_sound(sound);
+        }
+        timer_stop(&timer);
+        add_repeat(result, &timer, n_frames);
+    }
+    seqt_quit(ctx);
+}
+
+static void bench_play_note(seqt_context *ctx) {
+    riv_host_start(&host, NULL, NULL, 0, 0);
+    seqt_init(ctx);
+    for (int track = 0; track < SEQT_NOTES_TRACKS; track++) {
+        bench_result *result = add_result("seqt_play_note", "none", 0, track, "note");
+        seqt_synthnote note = {
+            .synth = ctx->default_font.synths[track][0],
+            .start_freq = ctx->default_font.scale[5],
+            .end_freq = ctx->default_font.scale[5],
+            .amplitude = 1.0f,
+            .periods = 1,
+            .bps = 8.0f,
+        };
+        for (int r = 0; r < n_repeats; r++) {
+            bench_timer timer = {0};
+            timer_start(&timer);
+            for (int i = 0; i < BENCH_CALLS; i++) seqt_play_note(&note);
+            timer_stop(&timer);
+            add_repeat(result, &timer, BENCH_CALLS);
+        }
+    }
+}
+
+static void bench_read_incard(game_state *game, const uint8_t *bundle, uint32_t bundle_len) {
+    bench_result *result = add_result("read_incard_data", "bundle", 0, -1, "incard");
+    riv_host_start(&host, NULL, NULL, 0, 0);
+    init_game_state(game);
+    for (int r = 0; r < n_repeats; r++) {
+        bench_timer timer = {0};
+        for (int i = 0; i < BENCH_CALLS / 10; i++) {
+            game->n_songs = 0;
+            timer_start(&timer);
+            read_incard_data(game, bundle, bundle_len);
+            timer_stop(&timer);
+        }
+        add_repeat(result, &timer, BENCH_CALLS / 10);
+    }
+    if (game->n_songs != BENCH_BUNDLE_SONGS) fprintf(stderr, "read_incard_data found %d songs of %d\n", game->n_songs, BENCH_BUNDLE_SONGS);
+}
+
+static void print_results(void) {
+    printf("%-20s %-7s %4s %5s %5s %-6s %12s %12s %12s %12s\n", "benchmark", "source", "cols", "track", "notes", "unit", "median_ns", "min_ns", "max_ns", "instructions");
+    for (int i = 0; i < n_results; i++) {
+        bench_result *r = &results[i];
+        printf("%-20s %-7s %4d %5d %5d %-6s %12.1f %12.1f %12.1f ", r->name, r->source, r->n_cols, r->track, r->n_notes, r->unit,
+            median(r->ns, r->n_repeats), min_value(r->ns, r->n_repeats), max_value(r->ns, r->n_repeats));
+        if (instructions_fd >= 0) printf("%12.0f\n", median(r->instructions, r->n_repeats));
+        else printf("%12s\n", "-");
+    }
+}
+
+static bool write_json(const char *filename) {
+    FILE *file = fopen(filename, "w");
+    if (!file) return false;
+    fprintf(file, "{\"repeats\":%d,\"frames\":%d,\"instructions\":%s,\"results\":[", n_repeats, n_frames, instructions_fd >= 0 ? "true" : "false");
+    for (int i = 0; i < n_results; i++) {
+        bench_result *r = &results[i];
+        fprintf(file, "%s\n{\"name\":\"%s\",\"source\":\"%s\",\"cols\":%d,\"track\":%d,\"notes\":%d,\"unit\":\"%s\",", i ? "," : "",
+            r->name, r->source, r->n_cols, r->track, r->n_notes, r->unit);
+        fprintf(file, "\"ns\":{\"median\":%.1f,\"min\":%.1f,\"max\":%.1f,\"repeats\":[", median(r->ns, r->n_repeats),
+            min_value(r->ns, r->n_repeats), max_value(r->ns, r->n_repeats));
+        for (int k = 0; k < r->n_repeats; k++) fprintf(file, "%s%.1f", k ? "," : "", r->ns[k]);
+        fprintf(file, "]},\"instructions\":");
+        if (instructions_fd >= 0) fprintf(file, "%.0f}", median(r->instructions, r->n_repeats));
+        else fprintf(file, "null}");
+    }
+    fprintf(file, "\n]}\n");
+    return fclose(file) == 0;
+}
+
+int main(int argc, char *argv[]) {
+    const char *json_filename = "bench.json";
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "-repeats") == 0) n_repeats = clampu(atoi(argv[i+1]), 1, BENCH_MAX_REPEATS);
+        else if (strcmp(argv[i], "-frames") == 0) n_frames = clampu(atoi(argv[i+1]), 1, 1000000);
+        else if (strcmp(argv[i], "-o") == 0) json_filename = argv[i+1];
+    }
+    open_instructions_counter();
+
+    game_state *game = malloc(sizeof(game_state));
+    seqt_context *ctx = malloc(sizeof(seqt_context));
+    seqt_source *sources[2] = {make_bench_source(false), make_bench_source(true)};
+    const char *source_names[2] = {"sparse", "dense"};
+    uint32_t bundle_len = 0;
+    uint8_t *bundle = sources[0] && sources[1] ? make_bench_bundle(sources, &bundle_len) : NULL;
+    if (!game || !ctx || !bundle) return 2;
+    *ctx = (seqt_context){0};
+
+    for (int s = 0; s < 2; s++) {
+        bench_frames(game, sources[s], source_names[s]);
+        bench_live_notes(game, sources[s], source_names[s]);
+        bench_lane_mappings(game, sources[s], source_names[s]);
+        bench_poll_sound(ctx, sources[s], source_names[s]);
+    }
+    bench_play_note(ctx);
+    bench_read_incard(game, bundle, bundle_len);
+
+    print_results();
+    if (!write_json(json_filename)) {
+        fprintf(stderr, "failed to write %s\n", json_filename);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,21 @@
+#!/bin/sh
+# Records an outcard for each tape with the headless build, then replays them all
+# with the batch verifier, fails when a recomputed outcard differs and prints the
+# throughput from 1 thread to all cores.
+# usage: tools/check_batch.sh [tape...] (all tools/tapes by default)
+set -e
+cd "$(dirname "$0")/.."
+HEADLESS=tools/build/rhythm_headless
+VERIFY=tools/build/verify_batch
+[ -x $HEADLESS ] && [ -x $VERIFY ] || { echo "build first: make -C tools"; exit 1; }
+[ $# -gt 0 ] || set -- tools/tapes/*.tape
+JOBS=$(mktemp -d)
+trap 'rm -rf "$JOBS"' EXIT
+
+for tape in "$@"; do
+    name=$(basename "$tape" .tape)
+    args=$(sed -n 's/^# args://p' "$tape" | head -n 1)
+    cp "$tape" $JOBS/
+    RIV_QUIET=1 RIV_TAPE=$tape RIV_OUTCARD=$JOBS/$name.outcard $HEADLESS $args
+done
+$VERIFY -scaling $JOBS
@@ -0,0 +1,44 @@
+#!/bin/sh
+# Runs the normal and the HEADLESS host builds on each tape, fails when their
+# outcards differ and reports how much faster the headless build verifies a tape.
+# A "# args:" line in the tape holds the cartridge arguments and each "# expect:"
+# line an extended regular expression the outcard must match.
+# usage: tools/check_headless.sh [tape...] (all tools/tapes by default)
+set -e
+cd "$(dirname "$0")/.."
+NORMAL=tools/build/rhythm
+HEADLESS=tools/build/rhythm_headless
+REPEAT=${REPEAT:-5}
+[ -x $NORMAL ] && [ -x $HEADLESS ] || { echo "build first: make -C tools"; exit 1; }
+[ $# -gt 0 ] || set -- tools/tapes/*.tape
+OUT=$(mktemp -d)
+trap 'rm -rf "$OUT"' EXIT
+
+# total run time of REPEAT runs, in microseconds
+time_runs() {
+    start=$(date +%s%N)
+    i=0
+    while [ $i -lt $REPEAT ]; do
+        RIV_QUIET=1 RIV_TAPE=$2 RIV_OUTCARD=/dev/null $1 $3
+        i=$((i + 1))
+    done
+    echo $((($(date +%s%N) - start) / 1000))
+}
+
+status=0
+printf "%-28s %8s %12s %12s %8s\n" tape outcard normal_us headless_us speedup
+for tape in "$@"; do
+    args=$(sed -n 's/^# args://p' "$tape" | head -n 1)
+    RIV_QUIET=1 RIV_TAPE=$tape RIV_OUTCARD=$OUT/normal $NORMAL $args
+    RIV_QUIET=1 RIV_TAPE=$tape RIV_OUTCARD=$OUT/headless $HEADLESS $args
+    if cmp -s $OUT/normal $OUT/headless; then match=same; else match=DIFF; status=1; fi
+    sed -n 's/^# expect: //p' "$tape" > $OUT/expect
+    while read -r pattern; do
+        grep -Eq "$pattern" $OUT/normal || { match=UNEXPECTED; status=1; }
+    done < $OUT/expect
+    normal=$(time_runs $NORMAL "$tape" "$args")
+    headless=$(time_runs $HEADLESS "$tape" "$args")
+    speedup=$(awk "BEGIN { printf \"%.2fx\", $normal / ($headless > 0 ? $headless : 1) }")
+    printf "%-28s %8s %12d %12d %8s\n" "$(basename "$tape")" $match $((normal / REPEAT)) $((headless / REPEAT)) $speedup
+done
+exit $status
@@ -0,0 +1,232 @@
+// Snapshot check: plays a tape through, snapshots the game at evenly spaced
+// frames once it has started (the random wait before is not part of snapshots),
+// restores each snapshot into a fresh game at that frame and plays the rest of
+// the tape, failing when its final outcard differs from the uninterrupted run.
+// Also checks that truncated snapshots and snapshots with out of range fields
+// are rejected and leave the game untouched, and reports the snapshot sizes and
+// the time to snapshot and to restore.
+// usage: check_snapshot [-points n] [-repeat n] <tape...>
+#define main rhythm_main
+#include "rhythm.c"
+#undef main
+
+#include "riv_host.h"
+#include <stdio.h>
+#include <time.h>
+
+enum {
+    MAX_TAPE_ARGS = 64,
+    MAX_ARGS_LEN = 1024,
+    SNAPSHOT_BUFFER_SIZE = 1024*1024,
+};
+
+static char *tape_argv[MAX_TAPE_ARGS+1] = {"rhythm"};
+static int tape_argc = 1;
+static char tape_args[MAX_ARGS_LEN];
+static uint8_t reference_outcard[RIV_SIZE_OUTCARD];
+static uint32_t reference_outcard_len;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Read the "# args:" line of a tape into tape_argv
+static void load_tape_args(const char *filename) {
+    tape_argc = 1;
+    tape_args[0] = '\0';
+    FILE *file = fopen(filename, "r");
+    char line[MAX_ARGS_LEN];
+    while (file && fgets(line, sizeof(line), file) && line[0] == '#') {
+        if (strncmp(line, "# args:", 7) == 0) {
+            snprintf(tape_args, sizeof(tape_args), "%s", line + 7);
+            break;
+        }
+    }
+    if (file) fclose(file);
+    char *rest;
+    for (char *token = strtok_r(tape_args, " \t\r\n", &rest); token && tape_argc < MAX_TAPE_ARGS; token = strtok_r(NULL, " \t\r\n", &rest)) {
+        tape_argv[tape_argc++] = token;
+    }
+}
+
+// Start a game on the tape, like the cartridge entry point
+static void start_game_run(game_state *game, riv_host *host, const riv_host_tape *tape) {
+    riv_host_start(host, tape, NULL, 0, 0);
+    host->quiet = true;
+    init_game_state(game);
+    char *argv[MAX_TAPE_ARGS+1];
+    memcpy(argv, tape_argv, sizeof(argv));
+    parse_arguments(game, tape_argc, argv);
+    initialize(game);
+}
+
+enum {
+    CORRUPT_END_REASON,
+    CORRUPT_FOCUS_TRACK,
+    CORRUPT_EVENT_TYPE,
+    CORRUPT_ARROW_LANE,
+    CORRUPT_TICK_LANE,
+    N_CORRUPTIONS,
+};
+
+static const char *corruption_names[N_CORRUPTIONS] = {"end_reason", "focus_track", "event type", "arrow lane", "tick lane"};
+
+// Put one field of the game out of range, false when there is no such field to corrupt
+static bool corrupt_field(game_state *game, int corruption) {
+    switch (corruption) {
+    case CORRUPT_END_REASON: game->end_reason = MISSES_END + 1; return true;
+    case CORRUPT_FOCUS_TRACK: game->focus_track = SEQT_NOTES_TRACKS; return true;
+    default: break;
+    }
+    for (int k = game->chart_cursor; k < game->chart_len; k++) {
+        chart_event *event = &game->chart[k];
+        if (corruption == CORRUPT_EVENT_TYPE) {
+            event->type = CHART_INTERVAL_CHANGE + 1;
+            return true;
+        }
+        if (corruption == CORRUPT_ARROW_LANE && event->type == CHART_ARROW) {
+            event->lane = game->n_cols;
+            return true;
+        }
+        if (corruption == CORRUPT_TICK_LANE && event->type == CHART_TICK) {
+            event->lane = MAX_TICKS;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Play the tape through, snapshotting before the update of each point frame
+static void play_with_snapshots(game_state *game, riv_host *host, const riv_host_tape *tape,
+                                const uint64_t *points, int n_points, uint8_t **snapshots, size_t *sizes) {
+    start_game_run(game, host, tape);
+    int p = 0;
+    do {
+        while (p < n_points && riv->frame == points[p]) {
+            sizes[p] = snapshot_game(game, snapshots[p], SNAPSHOT_BUFFER_SIZE);
+            p++;
+        }
+        update(game);
+    } while (riv_present());
+}
+
+int main(int argc, char *argv[]) {
+    int n_points = 8;
+    int repeat = 1000;
+    int first_tape = 1;
+    for (; first_tape < argc && argv[first_tape][0] == '-' && first_tape + 1 < argc; first_tape += 2) {
+        if (strcmp(argv[first_tape], "-points") == 0) n_points = clampu(atoi(argv[first_tape+1]), 1, 1024);
+        else if (strcmp(argv[first_tape], "-repeat") == 0) repeat = clampu(atoi(argv[first_tape+1]), 1, 1000000);
+    }
+    if (first_tape >= argc) {
+        fprintf(stderr, "usage: %s [-points n] [-repeat n] <tape...>\n", argv[0]);
+        return 2;
+    }
+
+    game_state *game = malloc(sizeof(game_state));
+    game_state *restored = malloc(sizeof(game_state));
+    riv_host *host = malloc(sizeof(riv_host));
+    uint64_t *points = malloc(n_points * sizeof(uint64_t));
+    size_t *sizes = calloc(n_points, sizeof(size_t));
+    uint8_t **snapshots = calloc(n_points, sizeof(uint8_t*));
+    if (!game || !restored || !host || !points || !sizes || !snapshots) return 2;
+    uint8_t *scratch[2] = {malloc(SNAPSHOT_BUFFER_SIZE), malloc(SNAPSHOT_BUFFER_SIZE)};
+    if (!scratch[0] || !scratch[1]) return 2;
+    for (int p = 0; p < n_points; p++) {
+        if (!(snapshots[p] = malloc(SNAPSHOT_BUFFER_SIZE))) return 2;
+    }
+
+    int status = 0;
+    printf("%-20s %6s %8s %8s %12s %12s %8s\n", "tape", "points", "min_b", "max_b", "snapshot_ns", "restore_ns", "outcard");
+    for (int t = first_tape; t < argc; t++) {
+        riv_host_tape tape;
+        if (!riv_host_load_tape(argv[t], &tape) || tape.n_frames < 2) {
+            fprintf(stderr, "failed to load tape %s\n", argv[t]);
+            return 2;
+        }
+        load_tape_args(argv[t]);
+
+        // uninterrupted run, with the snapshots spread over the frames played after the start
+        start_game_run(game, host, &tape);
+        uint64_t start_frame = 0;
+        do {
+            update(game);
+            if (game->started && !start_frame) start_frame = riv->frame + 1;
+        } while (riv_present());
+        uint64_t n_frames = riv->frame + 1;
+        if (!start_frame || start_frame >= n_frames) {
+            fprintf(stderr, "%s: the game doesn't start\n", argv[t]);
+            return 2;
+        }
+        reference_outcard_len = riv->outcard_len;
+        memcpy(reference_outcard, riv->outcard, reference_outcard_len);
+        release_game(game);
+        for (int p = 0; p < n_points; p++) points[p] = start_frame + (n_frames - start_frame) * p / n_points;
+        play_with_snapshots(game, host, &tape, points, n_points, snapshots, sizes);
+        bool same = riv->outcard_len == reference_outcard_len && memcmp(riv->outcard, reference_outcard, reference_outcard_len) == 0;
+        release_game(game);
+
+        // restore each snapshot at its frame and play the rest
+        size_t min_size = SIZE_MAX, max_size = 0;
+        for (int p = 0; p < n_points; p++) {
+            start_game_run(restored, host, &tape);
+            while (riv->frame < points[p]) riv_host_step(host, tape.frames[riv->frame + 1]);
+            // a truncated snapshot is rejected and leaves the game as it was
+            size_t before_size = snapshot_game(restored, scratch[0], SNAPSHOT_BUFFER_SIZE);
+            bool truncated_ok = restore_game(restored, snapshots[p], sizes[p] - 1);
+            size_t after_size = snapshot_game(restored, scratch[1], SNAPSHOT_BUFFER_SIZE);
+            if (truncated_ok || before_size != after_size || memcmp(scratch[0], scratch[1], before_size) != 0) {
+                fprintf(stderr, "%s: truncated snapshot at frame %llu changed the game\n", argv[t], (unsigned long long)points[p]);
+                same = false;
+            }
+            if (!restore_game(restored, snapshots[p], sizes[p])) {
+                fprintf(stderr, "%s: snapshot at frame %llu rejected\n", argv[t], (unsigned long long)points[p]);
+                same = false;
+            } else {
+                // so is a snapshot of this frame with a field out of range
+                before_size = snapshot_game(restored, scratch[0], SNAPSHOT_BUFFER_SIZE);
+                for (int c = 0; c < N_CORRUPTIONS; c++) {
+                    *game = *restored;
+                    if (!corrupt_field(game, c)) continue;
+                    size_t corrupted_size = snapshot_game(game, scratch[1], SNAPSHOT_BUFFER_SIZE);
+                    bool corrupted_ok = restore_game(restored, scratch[1], corrupted_size);
+                    after_size = snapshot_game(restored, scratch[1], SNAPSHOT_BUFFER_SIZE);
+                    if (corrupted_ok || before_size != after_size || memcmp(scratch[0], scratch[1], before_size) != 0) {
+                        fprintf(stderr, "%s: snapshot at frame %llu with a bad %s changed the game\n", argv[t], (unsigned long long)points[p], corruption_names[c]);
+                        same = false;
+                    }
+                }
+                run(restored);
+                if (riv->outcard_len != reference_outcard_len || memcmp(riv->outcard, reference_outcard, reference_outcard_len) != 0) {
+                    fprintf(stderr, "%s: restored at frame %llu, outcard differs\n", argv[t], (unsigned long long)points[p]);
+                    same = false;
+                }
+            }
+            release_game(restored);
+            min_size = minu(min_size, sizes[p]);
+            max_size = maxu(max_size, sizes[p]);
+        }
+
+        // time snapshotting and restoring the middle snapshot
+        int mid = n_points / 2;
+        start_game_run(restored, host, &tape);
+        while (riv->frame < points[mid]) riv_host_step(host, tape.frames[riv->frame + 1]);
+        restore_game(restored, snapshots[mid], sizes[mid]);
+        uint64_t start = now_ns();
+        for (int i = 0; i < repeat; i++) snapshot_game(restored, snapshots[mid], SNAPSHOT_BUFFER_SIZE);
+        uint64_t snapshot_ns = (now_ns() - start) / repeat;
+        start = now_ns();
+        for (int i = 0; i < repeat; i++) restore_game(restored, snapshots[mid], sizes[mid]);
+        uint64_t restore_ns = (now_ns() - start) / repeat;
+        release_game(restored);
+
+        const char *name = strrchr(argv[t], '/') ? strrchr(argv[t], '/') + 1 : argv[t];
+        printf("%-20s %6d %8zu %8zu %12llu %12llu %8s\n", name, n_points, min_size, max_size,
+            (unsigned long long)snapshot_ns, (unsigned long long)restore_ns, same ? "same" : "DIFF");
+        if (!same) status = 1;
+        riv_host_free_tape(&tape);
+    }
+    return status;
+}
@@ -0,0 +1,181 @@
+// Sound handle check: fills every seqt sound slot, checks the next play fails,
+// that stopped and finished sounds free their slot and that their old ids stay
+// invalid once the slot is reused, that loop ranges wrap the music position, then
+// plays, pauses and stops sounds at random while polling, checking the active list
+// against the sounds after each frame.
+// Reports the time of a play plus a stop and of a handle lookup.
+// usage: check_sounds [-ops n] [song] (seqs/f6.seqt.01.rivcard by default)
+#define SEQT_IMPL
+#include "seqt.h"
+
+#include "riv_host.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static riv_host host;
+static seqt_context ctx;
+static int n_failures;
+
+#define CHECK(cond) do { if (!(cond)) { fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); n_failures++; } } while (0)
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint64_t next_random(uint64_t *x) {
+    *x = *x * 6364136223846793005ull + 1442695040888963407ull;
+    return *x >> 33;
+}
+
+// the active list holds exactly the playing sounds that are not paused
+static void check_active_list(void) {
+    uint32_t n_active = 0, n_used = 0;
+    for (uint32_t slot = 1; slot <= SEQT_MAX_SOUNDS; slot++) {
+        seqt_sound *sound = &ctx.sounds[slot];
+        bool active = sound->id != 0 && !sound->paused;
+        n_active += active;
+        n_used += sound->id != 0;
+        CHECK((ctx.active_positions[slot] != 0) == active);
+        if (ctx.active_positions[slot]) CHECK(ctx.active_slots[ctx.active_positions[slot] - 1] == slot);
+    }
+    CHECK(n_active == ctx.n_active_slots);
+    CHECK(ctx.n_free_slots + n_used == SEQT_MAX_SOUNDS);
+}
+
+static uint32_t count_valid(const uint64_t *ids, uint32_t n) {
+    uint32_t n_valid = 0;
+    for (uint32_t i = 0; i < n; i++) n_valid += seqt_is_valid(&ctx, ids[i]);
+    return n_valid;
+}
+
+// Poll frames until the sound plays its next note step, returns its music position or -1 once it stopped
+static uint64_t poll_next_step(uint64_t id) {
+    seqt_sound *sound = seqt_get_sound(&ctx, id);
+    if (!sound) return (uint64_t)-1;
+    uint64_t note_frame = sound->last_note_frame;
+    while (seqt_is_valid(&ctx, id) && sound->last_note_frame == note_frame) {
+        riv_host_step(&host, 0);
+        seqt_poll(&ctx);
+    }
+    return seqt_is_valid(&ctx, id) ? sound->last_step : (uint64_t)-1;
+}
+
+int main(int argc, char *argv[]) {
+    const char *filename = "seqs/f6.seqt.01.rivcard";
+    uint64_t n_ops = 50000;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-ops") == 0 && i + 1 < argc) n_ops = strtoull(argv[++i], NULL, 10);
+        else filename = argv[i];
+    }
+    riv_host_start(&host, NULL, NULL, 0, 0);
+    host.quiet = true;
+    seqt_init(&ctx);
+    seqt_source *source = seqt_make_source_from_file(filename);
+    if (!source) {
+        fprintf(stderr, "failed to load song %s\n", filename);
+        return 2;
+    }
+
+    // every slot can be played and found again, the next play fails
+    uint64_t ids[SEQT_MAX_SOUNDS];
+    for (uint32_t i = 0; i < SEQT_MAX_SOUNDS; i++) ids[i] = seqt_play(&ctx, source, 1);
+    CHECK(count_valid(ids, SEQT_MAX_SOUNDS) == SEQT_MAX_SOUNDS);
+    for (uint32_t i = 0; i < SEQT_MAX_SOUNDS; i++) CHECK(seqt_get_sound(&ctx, ids[i]) && seqt_get_sound(&ctx, ids[i])->id == ids[i]);
+    CHECK(seqt_play(&ctx, source, 1) == 0);
+    CHECK(!seqt_is_valid(&ctx, 0));
+    check_active_list();
+
+    // a stopped sound id stays invalid after its slot is reused
+    uint64_t stale = ids[SEQT_MAX_SOUNDS - 1];
+    seqt_stop(&ctx, stale);
+    CHECK(!seqt_is_valid(&ctx, stale));
+    ids[SEQT_MAX_SOUNDS - 1] = seqt_play(&ctx, source, 1);
+    uint64_t slot_mask = ((uint64_t)1 << SEQT_SOUND_SLOT_BITS) - 1;
+    CHECK((ids[SEQT_MAX_SOUNDS - 1] & slot_mask) == (stale & slot_mask));
+    CHECK(seqt_is_valid(&ctx, ids[SEQT_MAX_SOUNDS - 1]));
+    CHECK(!seqt_is_valid(&ctx, stale));
+    seqt_stop(&ctx, stale); // stopping a stale id leaves the new sound playing
+    CHECK(seqt_is_valid(&ctx, ids[SEQT_MAX_SOUNDS - 1]));
+    check_active_list();
+
+    // finished sounds free their slots
+    for (uint32_t i = 0; i < SEQT_MAX_SOUNDS; i++) seqt_set_stop(&ctx, ids[i], 0.0);
+    for (int f = 0; f < 2; f++) {
+        riv_host_step(&host, 0);
+        seqt_poll(&ctx);
+    }
+    CHECK(count_valid(ids, SEQT_MAX_SOUNDS) == 0);
+    CHECK(ctx.n_free_slots == SEQT_MAX_SOUNDS);
+    check_active_list();
+
+    // a loop range set past its end waits for the next pass, then wraps on every
+    // pass and once cleared the sound goes on after the range
+    uint64_t id = seqt_play(&ctx, source, -1);
+    uint64_t track_size = seqt_get_source_track_size(source);
+    uint64_t step = 0;
+    while (step < 6) step = poll_next_step(id);
+    seqt_set_loop(&ctx, id, 2, 4);
+    CHECK(poll_next_step(id) == 7);
+    while (step < track_size + 2) step = poll_next_step(id);
+    for (int i = 0; i < 8; i++) {
+        step = poll_next_step(id);
+        CHECK(step >= track_size + 2 && step < track_size + 4);
+    }
+    seqt_set_loop(&ctx, id, 0, 0);
+    if (step == track_size + 2) step = poll_next_step(id);
+    CHECK(poll_next_step(id) == track_size + 4);
+    seqt_stop(&ctx, id);
+
+    // random plays, pauses and stops, one frame polled every few operations,
+    // the sounds loop forever so only stops free slots
+    uint64_t x = 1;
+    uint32_t n_ids = 0;
+    for (uint64_t op = 0; op < n_ops; op++) {
+        uint64_t r = next_random(&x);
+        uint32_t k = (uint32_t)(r % SEQT_MAX_SOUNDS);
+        if (k >= n_ids) {
+            uint64_t id = seqt_play(&ctx, source, -1);
+            CHECK(id != 0);
+            ids[n_ids++] = id;
+        } else if ((r >> 8) % 4 == 0) {
+            seqt_sound *sound = seqt_get_sound(&ctx, ids[k]);
+            CHECK(sound != NULL);
+            if (sound) seqt_set_paused(&ctx, ids[k], !sound->paused);
+        } else {
+            uint64_t id = ids[k];
+            seqt_stop(&ctx, id);
+            CHECK(!seqt_is_valid(&ctx, id));
+            ids[k] = ids[--n_ids];
+        }
+        if (op % 16 == 0) {
+            riv_host_step(&host, 0);
+            seqt_poll(&ctx);
+            check_active_list();
+            CHECK(count_valid(ids, n_ids) == n_ids);
+        }
+    }
+    seqt_quit(&ctx);
+    CHECK(ctx.n_free_slots == SEQT_MAX_SOUNDS && ctx.n_active_slots == 0);
+
+    // timings, a play includes compiling the song waves
+    uint64_t start = now_ns();
+    for (uint64_t op = 0; op < n_ops; op++) seqt_stop(&ctx, seqt_play(&ctx, source, 1));
+    double play_stop_ns = (double)(now_ns() - start) / n_ops;
+    for (uint32_t i = 0; i < SEQT_MAX_SOUNDS; i++) ids[i] = seqt_play(&ctx, source, 1);
+    uint64_t n_found = 0;
+    start = now_ns();
+    for (uint64_t op = 0; op < n_ops; op++) n_found += seqt_get_sound(&ctx, ids[op % SEQT_MAX_SOUNDS]) != NULL;
+    double lookup_ns = (double)(now_ns() - start) / n_ops;
+    CHECK(n_found == n_ops);
+    seqt_quit(&ctx);
+    seqt_destroy_source(source);
+
+    printf("%-10s %12s %14s %10s %8s\n", "ops", "frames", "play_stop_ns", "lookup_ns", "result");
+    printf("%-10llu %12llu %14.1f %10.2f %8s\n", (unsigned long long)n_ops, (unsigned long long)host.ctx.frame,
+        play_stop_ns, lookup_ns, n_failures ? "FAIL" : "ok");
+    return n_failures ? 1 : 0;
+}
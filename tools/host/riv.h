@@ -0,0 +1,167 @@
+// Host stand-in for the parts of the RIV API used by rhythm.c and seqt.h.
+// It lets the cartridge logic run as a plain program for tests, benchmarks and
+// batch verification, it is not the RIV emulator: drawing does nothing, audio
+// waves are only counted and the random generator is a fixed xorshift.
+#ifndef RIV_HOST_RIV_H
+#define RIV_HOST_RIV_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+enum {
+    RIV_SIZE_OUTCARD = 256*1024,
+    RIV_NUM_COLORS = 256,
+};
+
+// gamepad keys, host tapes store one bit per key in this order
+enum {
+    RIV_GAMEPAD1_LEFT,
+    RIV_GAMEPAD1_UP,
+    RIV_GAMEPAD1_DOWN,
+    RIV_GAMEPAD1_RIGHT,
+    RIV_GAMEPAD1_L1,
+    RIV_GAMEPAD1_R1,
+    RIV_GAMEPAD1_A1,
+    RIV_GAMEPAD1_A2,
+    RIV_GAMEPAD1_A3,
+    RIV_GAMEPAD1_A4,
+    RIV_GAMEPAD1_L2,
+    RIV_GAMEPAD1_R2,
+    RIV_GAMEPAD1_SELECT,
+    RIV_GAMEPAD1_START,
+    RIV_NUM_KEYCODE,
+};
+
+enum {
+    RIV_COLOR_BLACK,
+    RIV_COLOR_DARKBLUE,
+    RIV_COLOR_DARKPURPLE,
+    RIV_COLOR_DARKGREEN,
+    RIV_COLOR_BROWN,
+    RIV_COLOR_DARKGREY,
+    RIV_COLOR_LIGHTGREY,
+    RIV_COLOR_WHITE,
+    RIV_COLOR_RED,
+    RIV_COLOR_ORANGE,
+    RIV_COLOR_YELLOW,
+    RIV_COLOR_GREEN,
+    RIV_COLOR_BLUE,
+    RIV_COLOR_LAVENDER,
+    RIV_COLOR_PINK,
+    RIV_COLOR_LIGHTPEACH,
+    RIV_COLOR_GOLD,
+    RIV_COLOR_LIGHTBLUE,
+    RIV_COLOR_LIGHTGREEN,
+    RIV_COLOR_LIGHTRED,
+    RIV_COLOR_DARKPINK,
+    RIV_COLOR_LIGHTTEAL,
+    RIV_COLOR_GREY,
+    RIV_COLOR_SLATE,
+    RIV_COLOR_DARKSLATE,
+};
+
+enum {
+    RIV_SPRITESHEET_FONT_3X5 = 0,
+    RIV_SPRITESHEET_FONT_5X7 = 1,
+};
+
+enum {
+    RIV_TOPLEFT,
+    RIV_TOP,
+    RIV_TOPRIGHT,
+    RIV_LEFT,
+    RIV_CENTER,
+    RIV_RIGHT,
+    RIV_BOTTOMLEFT,
+    RIV_BOTTOM,
+    RIV_BOTTOMRIGHT,
+};
+
+typedef enum riv_waveform_type {
+    RIV_WAVEFORM_NONE,
+    RIV_WAVEFORM_SINE,
+    RIV_WAVEFORM_SQUARE,
+    RIV_WAVEFORM_TRIANGLE,
+    RIV_WAVEFORM_SAWTOOTH,
+    RIV_WAVEFORM_NOISE,
+    RIV_WAVEFORM_PULSE,
+    RIV_WAVEFORM_ORGAN,
+    RIV_WAVEFORM_TILTED_SAWTOOTH,
+} riv_waveform_type;
+
+#define RIV_NOTE_C0 16.35f
+#define RIV_NOTE_C1 32.70f
+#define RIV_NOTE_Eb2 77.78f
+#define RIV_NOTE_Eb3 155.56f
+#define RIV_NOTE_C4 261.63f
+#define RIV_NOTE_C6 1046.50f
+#define RIV_NOTE_Eb6 1244.51f
+#define RIV_NOTE_C7 2093.00f
+#define RIV_NOTE_Eb7 2489.02f
+#define RIV_NOTE_Eb8 4978.03f
+
+typedef struct riv_waveform_desc {
+    uint32_t id;
+    riv_waveform_type type;
+    float delay;
+    float attack;
+    float decay;
+    float sustain;
+    float release;
+    float start_frequency;
+    float end_frequency;
+    float amplitude;
+    float sustain_level;
+    float duty_cycle;
+    float pan;
+} riv_waveform_desc;
+
+typedef struct riv_key_state {
+    bool down;
+    bool up;
+    bool press;
+    bool release;
+} riv_key_state;
+
+// palette remap applied to the drawing calls while enabled
+typedef struct riv_draw_state {
+    bool pal_enabled;
+    uint8_t pal[RIV_NUM_COLORS];
+} riv_draw_state;
+
+typedef struct riv_vec2i {
+    int64_t x;
+    int64_t y;
+} riv_vec2i;
+
+typedef struct riv_context {
+    uint64_t frame;
+    uint32_t target_fps;
+    uint64_t quit_frame;
+    riv_key_state keys[RIV_NUM_KEYCODE];
+    riv_draw_state draw;
+    uint8_t *incard;
+    uint32_t incard_len;
+    uint8_t *outcard;
+    uint32_t outcard_len;
+} riv_context;
+
+// each thread runs its own instance
+extern _Thread_local riv_context *riv;
+
+uint64_t riv_waveform(riv_waveform_desc *desc);
+int riv_printf(const char *format, ...);
+int riv_snprintf(char *s, size_t maxlen, const char *format, ...);
+uint64_t riv_rand_uint(uint64_t high);
+int64_t riv_rand_int(int64_t low, int64_t high);
+bool riv_present(void);
+
+void riv_clear(uint32_t col);
+void riv_draw_rect_fill(int64_t x0, int64_t y0, int64_t w, int64_t h, uint32_t col);
+riv_vec2i riv_draw_text(const char *text, uint64_t sps_id, int anchor, int64_t x, int64_t y, int64_t size, int64_t col);
+void riv_draw_sprite(uint32_t n, uint64_t sps_id, int64_t x0, int64_t y0, int64_t nw, int64_t nh, int64_t sw, int64_t sh);
+uint64_t riv_make_image(const char *filename, int64_t color_key);
+uint64_t riv_make_spritesheet(uint64_t img_id, uint32_t w, uint32_t h);
+
+#endif
@@ -0,0 +1,152 @@
+// Host runtime, see riv_host.h
+#include "riv_host.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+
+_Thread_local riv_context *riv;
+
+static riv_host *current_host(void) {
+    return (riv_host*)riv;
+}
+
+bool riv_host_load_tape(const char *filename, riv_host_tape *tape) {
+    FILE *file = fopen(filename, "r");
+    if (!file) return false;
+    uint64_t capacity = 1024;
+    *tape = (riv_host_tape){.frames = malloc(capacity * sizeof(uint16_t))};
+    char line[64];
+    while (tape->frames && fgets(line, sizeof(line), file)) {
+        if (line[0] == '#') continue;
+        if (tape->n_frames == capacity) {
+            capacity *= 2;
+            uint16_t *frames = realloc(tape->frames, capacity * sizeof(uint16_t));
+            if (!frames) {
+                free(tape->frames);
+                tape->frames = NULL;
+                break;
+            }
+            tape->frames = frames;
+        }
+        tape->frames[tape->n_frames++] = (uint16_t)strtoul(line, NULL, 16);
+    }
+    fclose(file);
+    return tape->frames != NULL;
+}
+
+void riv_host_free_tape(riv_host_tape *tape) {
+    free(tape->frames);
+    *tape = (riv_host_tape){0};
+}
+
+uint8_t *riv_host_load_file(const char *filename, uint32_t *len) {
+    FILE *file = fopen(filename, "rb");
+    if (!file) return NULL;
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    uint8_t *data = size >= 0 ? malloc(size > 0 ? size : 1) : NULL;
+    if (data && fread(data, 1, size, file) != (size_t)size) {
+        free(data);
+        data = NULL;
+    }
+    fclose(file);
+    if (data) *len = (uint32_t)size;
+    return data;
+}
+
+static void set_keys(riv_host *host, uint16_t down) {
+    for (int k = 0; k < RIV_NUM_KEYCODE; k++) {
+        riv_key_state *key = &host->ctx.keys[k];
+        bool is_down = (down >> k) & 1;
+        key->press = is_down && !key->down;
+        key->release = !is_down && key->down;
+        key->down = is_down;
+        key->up = !is_down;
+    }
+}
+
+void riv_host_start(riv_host *host, const riv_host_tape *tape, uint8_t *incard, uint32_t incard_len, uint64_t seed) {
+    host->ctx = (riv_context){
+        .target_fps = RIV_HOST_FPS,
+        .incard = incard,
+        .incard_len = incard_len,
+        .outcard = host->outcard,
+    };
+    host->tape = tape;
+    host->rng = seed ? seed : 1;
+    host->n_waves = 0;
+    for (int c = 0; c < RIV_NUM_COLORS; c++) host->ctx.draw.pal[c] = c;
+    riv = &host->ctx;
+    set_keys(host, tape && tape->n_frames > 0 ? tape->frames[0] : 0);
+}
+
+void riv_host_step(riv_host *host, uint16_t down) {
+    host->ctx.frame++;
+    set_keys(host, down);
+}
+
+bool riv_present(void) {
+    riv_host *host = current_host();
+    uint64_t frame = host->ctx.frame + 1;
+    if (host->ctx.quit_frame && frame >= host->ctx.quit_frame) return false;
+    if (host->tape && frame >= host->tape->n_frames) return false;
+    riv_host_step(host, host->tape ? host->tape->frames[frame] : 0);
+    return true;
+}
+
+uint64_t riv_waveform(riv_waveform_desc *desc) {
+    (void)desc;
+    return ++current_host()->n_waves;
+}
+
+int riv_printf(const char *format, ...) {
+    if (current_host() && current_host()->quiet) return 0;
+    va_list args;
+    va_start(args, format);
+    int n = vfprintf(stderr, format, args);
+    va_end(args);
+    return n;
+}
+
+int riv_snprintf(char *s, size_t maxlen, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(s, maxlen, format, args);
+    va_end(args);
+    return n;
+}
+
+uint64_t riv_rand_uint(uint64_t high) {
+    uint64_t *x = &current_host()->rng;
+    *x ^= *x << 13;
+    *x ^= *x >> 7;
+    *x ^= *x << 17;
+    return high == UINT64_MAX ? *x : *x % (high + 1);
+}
+
+int64_t riv_rand_int(int64_t low, int64_t high) {
+    return low + (int64_t)riv_rand_uint((uint64_t)(high - low));
+}
+
+// drawing is not needed to reproduce outcards
+void riv_clear(uint32_t col) { (void)col; }
+void riv_draw_rect_fill(int64_t x0, int64_t y0, int64_t w, int64_t h, uint32_t col) {
+    (void)x0; (void)y0; (void)w; (void)h; (void)col;
+}
+riv_vec2i riv_draw_text(const char *text, uint64_t sps_id, int anchor, int64_t x, int64_t y, int64_t size, int64_t col) {
+    (void)text; (void)sps_id; (void)anchor; (void)size; (void)col;
+    return (riv_vec2i){x, y};
+}
+void riv_draw_sprite(uint32_t n, uint64_t sps_id, int64_t x0, int64_t y0, int64_t nw, int64_t nh, int64_t sw, int64_t sh) {
+    (void)n; (void)sps_id; (void)x0; (void)y0; (void)nw; (void)nh; (void)sw; (void)sh;
+}
+uint64_t riv_make_image(const char *filename, int64_t color_key) {
+    (void)filename; (void)color_key;
+    return 1;
+}
+uint64_t riv_make_spritesheet(uint64_t img_id, uint32_t w, uint32_t h) {
+    (void)w; (void)h;
+    return img_id;
+}
@@ -0,0 +1,39 @@
+// Host runtime for the RIV stand-in API in riv.h: a run owns a context, its
+// outcard buffer and the tape that feeds its keys. riv points to the run of
+// the calling thread, so many runs can go on side by side.
+#ifndef RIV_HOST_H
+#define RIV_HOST_H
+
+#include "riv.h"
+
+enum {
+    RIV_HOST_FPS = 60,
+};
+
+// Keys held down on each frame, bit k is key code k.
+// Tape files hold one hexadecimal mask per line, lines starting with # are skipped.
+typedef struct riv_host_tape {
+    uint16_t *frames;
+    uint64_t n_frames;
+} riv_host_tape;
+
+typedef struct riv_host {
+    riv_context ctx; // first, riv points here
+    const riv_host_tape *tape; // the run ends with its last frame, NULL runs until quit
+    uint64_t rng;
+    uint64_t n_waves; // waves submitted by the music
+    bool quiet; // drop riv_printf output
+    uint8_t outcard[RIV_SIZE_OUTCARD];
+} riv_host;
+
+// Load a tape file, returns false when it can't be read
+bool riv_host_load_tape(const char *filename, riv_host_tape *tape);
+void riv_host_free_tape(riv_host_tape *tape);
+// Read a whole file into a new buffer, NULL when it can't be read
+uint8_t *riv_host_load_file(const char *filename, uint32_t *len);
+// Make host the run of this thread, at frame 0 with the tape first frame keys
+void riv_host_start(riv_host *host, const riv_host_tape *tape, uint8_t *incard, uint32_t incard_len, uint64_t seed);
+// Advance the run one frame with the given keys down
+void riv_host_step(riv_host *host, uint16_t down);
+
+#endif
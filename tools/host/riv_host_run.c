@@ -0,0 +1,41 @@
+// Runs a cartridge built for the host as a program: its main() parses the
+// arguments as usual, keys come from the tape in RIV_TAPE, the incard from
+// RIV_INCARD and the final outcard is written to RIV_OUTCARD (stdout by default).
+// RIV_SEED seeds the random generator, RIV_QUIET=1 drops riv_printf output.
+#include "riv_host.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+static riv_host host;
+static riv_host_tape tape;
+
+static void write_outcard(void) {
+    const char *filename = getenv("RIV_OUTCARD");
+    FILE *file = filename ? fopen(filename, "wb") : stdout;
+    if (!file) {
+        fprintf(stderr, "failed to write outcard %s\n", filename);
+        return;
+    }
+    fwrite(host.outcard, 1, host.ctx.outcard_len, file);
+    if (file != stdout) fclose(file);
+}
+
+__attribute__((constructor)) static void start_run(void) {
+    const char *tape_filename = getenv("RIV_TAPE");
+    if (tape_filename && !riv_host_load_tape(tape_filename, &tape)) {
+        fprintf(stderr, "failed to load tape %s\n", tape_filename);
+        exit(1);
+    }
+    uint32_t incard_len = 0;
+    uint8_t *incard = NULL;
+    const char *incard_filename = getenv("RIV_INCARD");
+    if (incard_filename && !(incard = riv_host_load_file(incard_filename, &incard_len))) {
+        fprintf(stderr, "failed to load incard %s\n", incard_filename);
+        exit(1);
+    }
+    const char *seed = getenv("RIV_SEED");
+    const char *quiet = getenv("RIV_QUIET");
+    riv_host_start(&host, tape_filename ? &tape : NULL, incard, incard_len, seed ? strtoull(seed, NULL, 10) : 0);
+    host.quiet = quiet && atoi(quiet);
+    atexit(write_outcard);
+}
@@ -0,0 +1,91 @@
+// Renders seqt songs offline with the default soundfont and writes them as WAV
+// files, reporting how much faster than realtime the render ran and how many
+// voices the song stacks up.
+// usage: render_seqt [-loops n] [-rate hz] [-o out.wav] [song...] (seqs/f6.seqt.01.rivcard by default)
+//   with many songs -o is only written for the last one
+#define SEQT_IMPL
+#define SEQT_RENDER
+#include "seqt.h"
+
+#include "riv_host.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+enum {
+    RENDER_TAIL_SECONDS = 4, // longest wave after the last note step
+};
+
+static riv_host host;
+static seqt_context ctx;
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static bool write_file(const char *filename, const uint8_t *data, uint64_t size) {
+    FILE *file = fopen(filename, "wb");
+    if (!file) return false;
+    bool ok = fwrite(data, 1, size, file) == size;
+    return fclose(file) == 0 && ok;
+}
+
+int main(int argc, char *argv[]) {
+    int32_t loops = 1;
+    uint32_t sample_rate = 44100;
+    const char *wav_filename = NULL;
+    const char *songs[256];
+    int n_songs = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-loops") == 0 && i + 1 < argc) loops = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-rate") == 0 && i + 1 < argc) sample_rate = (uint32_t)clampu(atoi(argv[++i]), 8000, 192000);
+        else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) wav_filename = argv[++i];
+        else if (n_songs < 256) songs[n_songs++] = argv[i];
+    }
+    if (n_songs == 0) songs[n_songs++] = "seqs/f6.seqt.01.rivcard";
+    riv_host_start(&host, NULL, NULL, 0, 0);
+    seqt_init(&ctx);
+
+    int status = 0;
+    printf("%-28s %10s %10s %10s %10s %8s %8s %8s\n", "song", "audio_s", "render_ms", "realtime", "waves", "dropped", "voices", "peak");
+    for (int s = 0; s < n_songs; s++) {
+        seqt_source *source = seqt_make_source_from_file(songs[s]);
+        if (!source) {
+            status = 1;
+            continue;
+        }
+        double seconds = seqt_get_source_length(source) * (loops > 0 ? loops : 1) + RENDER_TAIL_SECONDS;
+        uint64_t max_frames = (uint64_t)(seconds * sample_rate);
+        float *samples = malloc(2 * max_frames * sizeof(float));
+        if (!samples) return 2;
+        seqt_render_stats stats;
+        double start = now_seconds();
+        uint64_t n_frames = seqt_render_source(source, &ctx.default_font, loops, sample_rate, samples, max_frames, &stats);
+        double render_seconds = now_seconds() - start;
+        float peak = 0.0f;
+        for (uint64_t i = 0; i < 2*n_frames; i++) peak = fmaxf(peak, fabsf(samples[i]));
+
+        double audio_seconds = (double)n_frames / sample_rate;
+        const char *name = strrchr(songs[s], '/') ? strrchr(songs[s], '/') + 1 : songs[s];
+        printf("%-28s %10.2f %10.2f %9.0fx %10llu %8llu %8u %8.3f\n", name, audio_seconds, render_seconds * 1000.0,
+            audio_seconds / (render_seconds > 0 ? render_seconds : 1e-9), (unsigned long long)stats.n_waves,
+            (unsigned long long)stats.n_dropped_waves, stats.max_voices, peak);
+        if (n_frames == 0) status = 1;
+
+        if (wav_filename && s == n_songs - 1) {
+            uint64_t size = seqt_make_wav(samples, n_frames, sample_rate, NULL, 0);
+            uint8_t *wav = malloc(size);
+            if (!wav || seqt_make_wav(samples, n_frames, sample_rate, wav, size) != size || !write_file(wav_filename, wav, size)) {
+                fprintf(stderr, "failed to write %s\n", wav_filename);
+                status = 1;
+            }
+            free(wav);
+        }
+        free(samples);
+        seqt_destroy_source(source);
+    }
+    return status;
+}
@@ -0,0 +1,338 @@
+// Batch verifier: replays a directory of recorded runs with the headless game
+// logic on all cores and checks every recomputed outcard against the recorded one.
+// A job is <name>.tape (keys and its "# args:" line, see host/riv_host.h) with an
+// optional <name>.incard, and <name>.outcard holding the recorded outcard.
+// Tapes differ a lot in length (n_loops, max_misses), so jobs are dealt longest
+// first to per worker deques and a worker whose deque runs dry steals from the others.
+// Prints one line per job: name, match/MISMATCH/new/FAILED, frames and the outcard
+// (JSON, or hex for binary outcards), then the throughput of the run.
+// usage: verify_batch [-j threads] [-seed n] [-scaling] <job dir>
+//   -scaling runs the batch with 1, 2, 4... up to the threads count and reports each
+#define _GNU_SOURCE // qsort_r
+#define main rhythm_main
+#include "rhythm.c"
+#undef main
+
+#include "riv_host.h"
+#include <dirent.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+enum {
+    MAX_JOB_ARGS = 64,
+    MAX_ARGS_LEN = 1024,
+};
+
+enum {
+    JOB_MATCH,
+    JOB_MISMATCH,
+    JOB_NEW, // no recorded outcard to compare with
+    JOB_FAILED,
+};
+
+static const char *job_status_names[] = {"match", "MISMATCH", "new", "FAILED"};
+
+typedef struct job {
+    char *name;
+    char args[MAX_ARGS_LEN];
+    riv_host_tape tape;
+    uint8_t *incard;
+    uint32_t incard_len;
+    uint8_t *expected; // recorded outcard, NULL when there is none
+    uint32_t expected_len;
+    // result of the last run
+    uint8_t *outcard;
+    uint32_t outcard_len;
+    uint64_t n_frames;
+    int status;
+} job;
+
+// Owner takes from the head, thieves from the tail
+typedef struct job_deque {
+    pthread_mutex_t lock;
+    uint32_t *jobs;
+    uint32_t head;
+    uint32_t tail;
+} job_deque;
+
+typedef struct batch batch;
+
+typedef struct worker {
+    pthread_t thread;
+    batch *batch;
+    uint32_t index;
+    job_deque deque;
+    game_state *game;
+    riv_host *host;
+    uint8_t *incard; // copy of the job incard, the game may write to it
+    uint64_t n_steals;
+} worker;
+
+struct batch {
+    job *jobs;
+    uint32_t n_jobs;
+    uint32_t *order; // jobs by tape length, longest first
+    worker *workers;
+    uint32_t n_workers;
+    uint64_t seed;
+};
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static bool deque_pop(job_deque *deque, bool steal, uint32_t *out) {
+    pthread_mutex_lock(&deque->lock);
+    bool found = deque->head < deque->tail;
+    if (found) *out = steal ? deque->jobs[--deque->tail] : deque->jobs[deque->head++];
+    pthread_mutex_unlock(&deque->lock);
+    return found;
+}
+
+// Next job for a worker, its own first, then stolen from the next workers in turn.
+// No job is added while the batch runs, so a scan that finds nothing means it's done.
+static bool next_job(worker *w, uint32_t *out) {
+    if (deque_pop(&w->deque, false, out)) return true;
+    batch *b = w->batch;
+    for (uint32_t i = 1; i < b->n_workers; i++) {
+        if (deque_pop(&b->workers[(w->index + i) % b->n_workers].deque, true, out)) {
+            w->n_steals++;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void run_job(worker *w, job *j) {
+    char args[MAX_ARGS_LEN];
+    char *argv[MAX_JOB_ARGS+1] = {"rhythm"};
+    int argc = 1;
+    char *rest;
+    memcpy(args, j->args, sizeof(args));
+    for (char *token = strtok_r(args, " \t\r\n", &rest); token && argc < MAX_JOB_ARGS; token = strtok_r(NULL, " \t\r\n", &rest)) {
+        argv[argc++] = token;
+    }
+
+    if (j->incard_len > 0) memcpy(w->incard, j->incard, j->incard_len);
+    riv_host_start(w->host, &j->tape, w->incard, j->incard_len, w->batch->seed);
+    w->host->quiet = true;
+    init_game_state(w->game);
+    if (!parse_arguments(w->game, argc, argv)) {
+        j->status = JOB_FAILED;
+        return;
+    }
+    initialize(w->game);
+    run(w->game);
+    release_game(w->game);
+
+    j->n_frames = riv->frame + 1;
+    j->outcard_len = riv->outcard_len;
+    free(j->outcard);
+    j->outcard = malloc(j->outcard_len + 1);
+    if (!j->outcard) {
+        j->status = JOB_FAILED;
+        return;
+    }
+    memcpy(j->outcard, riv->outcard, j->outcard_len);
+    if (!j->expected) {
+        j->status = JOB_NEW;
+    } else if (j->expected_len == j->outcard_len && memcmp(j->expected, j->outcard, j->outcard_len) == 0) {
+        j->status = JOB_MATCH;
+    } else {
+        j->status = JOB_MISMATCH;
+    }
+}
+
+static void *run_worker(void *arg) {
+    worker *w = arg;
+    uint32_t i;
+    while (next_job(w, &i)) run_job(w, &w->batch->jobs[i]);
+    return NULL;
+}
+
+static int compare_tape_length(const void *a, const void *b, void *arg) {
+    const job *jobs = arg;
+    uint64_t la = jobs[*(const uint32_t*)a].tape.n_frames;
+    uint64_t lb = jobs[*(const uint32_t*)b].tape.n_frames;
+    return (la < lb) - (la > lb);
+}
+
+// Run the whole batch with n workers, returns the elapsed seconds
+static double run_batch(batch *b, uint32_t n_workers) {
+    b->n_workers = n_workers;
+    for (uint32_t i = 0; i < n_workers; i++) {
+        worker *w = &b->workers[i];
+        w->deque.head = w->deque.tail = 0;
+        w->n_steals = 0;
+    }
+    // deal longest first, each worker starts with a similar share of frames
+    for (uint32_t k = 0; k < b->n_jobs; k++) {
+        job_deque *deque = &b->workers[k % n_workers].deque;
+        deque->jobs[deque->tail++] = b->order[k];
+    }
+    double start = now_seconds();
+    for (uint32_t i = 1; i < n_workers; i++) pthread_create(&b->workers[i].thread, NULL, run_worker, &b->workers[i]);
+    run_worker(&b->workers[0]);
+    for (uint32_t i = 1; i < n_workers; i++) pthread_join(b->workers[i].thread, NULL);
+    return now_seconds() - start;
+}
+
+static bool ends_with(const char *s, const char *suffix) {
+    size_t n = strlen(s), m = strlen(suffix);
+    return n >= m && strcmp(s + n - m, suffix) == 0;
+}
+
+static int compare_names(const void *a, const void *b) {
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+static bool load_job(job *j, const char *dir, const char *name) {
+    char path[4096];
+    j->name = strdup(name);
+    snprintf(path, sizeof(path), "%s/%s.tape", dir, name);
+    if (!riv_host_load_tape(path, &j->tape)) {
+        fprintf(stderr, "failed to load tape %s\n", path);
+        return false;
+    }
+    FILE *file = fopen(path, "r");
+    char line[MAX_ARGS_LEN];
+    while (file && fgets(line, sizeof(line), file) && line[0] == '#') {
+        if (strncmp(line, "# args:", 7) == 0) {
+            snprintf(j->args, sizeof(j->args), "%s", line + 7);
+            break;
+        }
+    }
+    if (file) fclose(file);
+    snprintf(path, sizeof(path), "%s/%s.incard", dir, name);
+    j->incard = riv_host_load_file(path, &j->incard_len);
+    snprintf(path, sizeof(path), "%s/%s.outcard", dir, name);
+    j->expected = riv_host_load_file(path, &j->expected_len);
+    return true;
+}
+
+// Load every <name>.tape of a directory, in name order
+static bool load_jobs(batch *b, const char *dir) {
+    DIR *d = opendir(dir);
+    if (!d) {
+        fprintf(stderr, "failed to open job directory %s\n", dir);
+        return false;
+    }
+    char **names = NULL;
+    uint32_t n = 0, capacity = 0;
+    for (struct dirent *entry; (entry = readdir(d)) != NULL;) {
+        if (!ends_with(entry->d_name, ".tape")) continue;
+        if (n == capacity) {
+            capacity = capacity ? 2*capacity : 64;
+            names = realloc(names, capacity * sizeof(char*));
+            if (!names) break;
+        }
+        names[n] = strdup(entry->d_name);
+        names[n][strlen(names[n]) - 5] = '\0';
+        n++;
+    }
+    closedir(d);
+    if (n == 0) {
+        fprintf(stderr, "no tapes in %s\n", dir);
+        return false;
+    }
+    qsort(names, n, sizeof(char*), compare_names);
+    b->jobs = calloc(n, sizeof(job));
+    b->order = calloc(n, sizeof(uint32_t));
+    bool ok = b->jobs && b->order;
+    for (uint32_t i = 0; ok && i < n; i++) {
+        ok = load_job(&b->jobs[i], dir, names[i]);
+        b->order[i] = i;
+        b->n_jobs++;
+    }
+    for (uint32_t i = 0; i < n; i++) free(names[i]);
+    free(names);
+    if (ok) qsort_r(b->order, b->n_jobs, sizeof(uint32_t), compare_tape_length, b->jobs);
+    return ok;
+}
+
+static bool make_workers(batch *b, uint32_t n_workers) {
+    uint32_t max_incard = 1;
+    for (uint32_t i = 0; i < b->n_jobs; i++) max_incard = maxu(max_incard, b->jobs[i].incard_len);
+    b->workers = calloc(n_workers, sizeof(worker));
+    if (!b->workers) return false;
+    for (uint32_t i = 0; i < n_workers; i++) {
+        worker *w = &b->workers[i];
+        w->batch = b;
+        w->index = i;
+        pthread_mutex_init(&w->deque.lock, NULL);
+        w->deque.jobs = malloc(b->n_jobs * sizeof(uint32_t));
+        w->game = malloc(sizeof(game_state));
+        w->host = malloc(sizeof(riv_host));
+        w->incard = malloc(max_incard);
+        if (!w->deque.jobs || !w->game || !w->host || !w->incard) return false;
+    }
+    return true;
+}
+
+static void print_outcard(const job *j) {
+    if (j->outcard_len >= 4 && memcmp(j->outcard, "JSON", 4) == 0) {
+        fwrite(j->outcard + 4, 1, j->outcard_len - 4, stdout);
+    } else {
+        for (uint32_t i = 0; i < j->outcard_len; i++) printf("%02x", j->outcard[i]);
+    }
+}
+
+static void print_throughput(batch *b, double seconds, double serial_seconds) {
+    uint64_t n_frames = 0, n_steals = 0;
+    for (uint32_t i = 0; i < b->n_jobs; i++) n_frames += b->jobs[i].n_frames;
+    for (uint32_t i = 0; i < b->n_workers; i++) n_steals += b->workers[i].n_steals;
+    printf("# threads %u: %u tapes in %.3f s, %.1f tapes/s, %.0f frames/s, %llu steals",
+        b->n_workers, b->n_jobs, seconds, b->n_jobs / seconds, n_frames / seconds, (unsigned long long)n_steals);
+    if (serial_seconds > 0) printf(", speedup %.2fx", serial_seconds / seconds);
+    printf("\n");
+}
+
+int main(int argc, char *argv[]) {
+    long n_cores = sysconf(_SC_NPROCESSORS_ONLN);
+    uint32_t n_threads = n_cores > 0 ? (uint32_t)n_cores : 1;
+    bool scaling = false;
+    batch b = {0};
+    const char *dir = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            n_threads = clampu(atoi(argv[++i]), 1, 1024);
+        } else if (strcmp(argv[i], "-seed") == 0 && i + 1 < argc) {
+            b.seed = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "-scaling") == 0) {
+            scaling = true;
+        } else {
+            dir = argv[i];
+        }
+    }
+    if (!dir) {
+        fprintf(stderr, "usage: %s [-j threads] [-seed n] [-scaling] <job dir>\n", argv[0]);
+        return 2;
+    }
+    if (!load_jobs(&b, dir) || !make_workers(&b, n_threads)) return 2;
+
+    double serial_seconds = 0;
+    if (scaling) {
+        for (uint32_t n = 1; n < n_threads; n *= 2) {
+            double seconds = run_batch(&b, n);
+            if (n == 1) serial_seconds = seconds;
+            print_throughput(&b, seconds, serial_seconds);
+        }
+    }
+    double seconds = run_batch(&b, n_threads);
+    if (n_threads == 1) serial_seconds = seconds;
+
+    int status = 0;
+    for (uint32_t i = 0; i < b.n_jobs; i++) {
+        job *j = &b.jobs[i];
+        printf("%s %s %llu ", j->name, job_status_names[j->status], (unsigned long long)j->n_frames);
+        if (j->outcard) print_outcard(j);
+        printf("\n");
+        if (j->status == JOB_MISMATCH || j->status == JOB_FAILED) status = 1;
+    }
+    print_throughput(&b, seconds, serial_seconds);
+    return status;
+}